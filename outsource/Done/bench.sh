@@ -0,0 +1,66 @@
+#!/bin/bash
+#
+# throughput benchmark of the SRF05 driver (mod.ko) on simulated sensors
+# (srf05-sim.ko), no hardware needed; run as root next to both modules
+#
+#   ./bench.sh [seconds] [engine_period_us] [sensors]
+#
+# further simulator parameters can be passed in SIM_ARGS, e.g.
+#   SIM_ARGS="distance_mm=500 noise_mm=20 dropout_pct=2 timeout_pct=1"
+#
+# every sensor is read by srf05bench (make srf05bench), in the mode given
+# by MODE, READ_VALUE ioctls by default
+#
+SECONDS_RUN=${1:-10}
+PERIOD_US=${2:-0}
+SENSORS=${3:-1}
+MODE=${MODE:-ioctl}
+DEBUGFS=/sys/kernel/debug
+
+set -e
+
+[ -x ./srf05bench ] || { echo "build srf05bench first" >&2; exit 1; }
+
+mountpoint -q $DEBUGFS || mount -t debugfs none $DEBUGFS
+
+insmod ./srf05-sim.ko sensors=$SENSORS $SIM_ARGS
+trap 'rmmod mod 2>/dev/null || true; rmmod srf05_sim' EXIT
+insmod ./mod.ko
+
+# let the driver bind to all simulated sensors
+sleep 1
+
+for dev in /sys/bus/iio/devices/iio:device*; do
+    if [ "$(cat $dev/name)" == "srf05" ]; then
+        echo $PERIOD_US > $dev/engine_period_us;
+    fi
+done
+
+# without the engine every READ_VALUE is one single shot, with it the
+# latest sample; either way the calls show up in ioctl_latency
+for node in /dev/srf05*; do
+    ./srf05bench -d $node -m $MODE -t $SECONDS_RUN > /dev/null &
+done
+wait || true
+
+echo "== sample rate [1/s] and samples"
+for rate in /sys/class/srf05/*/sample_rate; do
+    echo "$rate: $(cat $rate)";
+done
+echo "all: $(cat /sys/class/srf05/sample_rate)"
+
+for dir in $DEBUGFS/srf05/*; do
+    echo
+    echo "== $(basename $dir)"
+    for f in counters capture; do
+        cat $dir/$f;
+    done
+    for f in trigger_to_rising echo_width lock_wait ioctl_latency; do
+        echo "-- $f";
+        head -n 5 $dir/$f;
+    done
+done
+
+echo
+echo "== simulator"
+cat $DEBUGFS/srf05-sim/stats
@@ -0,0 +1,82 @@
+#!/bin/bash
+#
+# check and benchmark of the LED7 driver (led7gpio.ko) on a simulated
+# chain of display modules (led7-sim.ko), no hardware needed; run as root
+# next to both modules
+#
+#   ./led7-bench.sh [seconds] [refresh_hz] [modules]
+#
+# every test text is written to /dev/led7controls and has to show up on
+# the simulated display, decoded back from the shifted bits; the exit
+# status is the number of texts which did not. Then the display gets a
+# new number about every update_ms for the given time while the refresh
+# and the update to visible latency are measured.
+#
+SECONDS_RUN=${1:-10}
+REFRESH_HZ=${2:-100}
+MODULES=${3:-1}
+UPDATE_MS=${UPDATE_MS:-20}
+DEBUGFS=/sys/kernel/debug
+SIM=$DEBUGFS/led7-sim
+DEV=/dev/led7controls
+SYSFS=/sys/class/led7control/led7controls
+
+set -e
+
+mountpoint -q $DEBUGFS || mount -t debugfs none $DEBUGFS
+
+insmod ./led7-sim.ko modules=$MODULES
+insmod ./led7gpio.ko
+trap 'rmmod led7gpio; rmmod led7_sim' EXIT
+
+# let the driver bind to the simulated chain
+sleep 1
+
+echo $REFRESH_HZ > $SYSFS/refresh_hz
+
+# a new text is visible after at most two frames
+SETTLE=$(awk "BEGIN { print 2 / $REFRESH_HZ + 0.05 }")
+
+failures=0
+for text in 12345678 0 -.AbCdEf 1.2.3. 42 xyz 88888888; do
+    printf "%s" "$text" > $SIM/expect
+    printf "%s" "$text" > $DEV
+    sleep $SETTLE
+
+    want=$(head -n 1 $SIM/expect)
+    got=$(head -n 1 $SIM/display)
+    if [ "$want" == "$got" ]; then
+        echo "ok   '$text' -> '$got'"
+    else
+        echo "FAIL '$text' -> '$got', expected '$want'"
+        failures=$((failures + 1))
+    fi
+done
+
+echo
+echo "== updating every ${UPDATE_MS} ms for ${SECONDS_RUN} s at ${REFRESH_HZ} Hz"
+end=$(( $(date +%s) + SECONDS_RUN ))
+i=0
+while [ $(date +%s) -lt $end ]; do
+    printf "%d" $i > $SIM/expect
+    printf "%d" $i > $DEV
+    i=$(( (i + 1) % 100000000 ))
+    sleep $(awk "BEGIN { print $UPDATE_MS / 1000 }")
+done
+
+echo 0 > /sys/module/led7_sim/parameters/capture
+
+echo
+echo "== simulated display"
+cat $SIM/display
+cat $SIM/stats
+
+echo
+echo "== driver"
+cat $DEBUGFS/led7control/stats
+
+echo
+echo "== last transitions (ns line value)"
+tail -n 20 $SIM/capture
+
+exit $failures
@@ -0,0 +1,657 @@
+/*
+ * LED7 simulator: a GPIO chip decoding what led7gpio.c shifts out
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * the module registers a GPIO chip "led7-sim" with the three lines of a
+ * chain of 74HC595 based display modules (sclk at 0, rclk at 1, dio at
+ * 2) and a "gpio_led7segment_sample" platform device with a GPIO lookup
+ * table pointing at them and the "phuongnam,chain-length" property, so
+ * the LED7 driver binds to the simulated chain the same way it binds to
+ * a real one.
+ *
+ * every transition of the lines is timestamped and, while capture is
+ * set, recorded in a ring of capture_len entries. The chip also models
+ * the shift registers: a rising sclk shifts dio in, a rising rclk
+ * latches the words of all modules, which are decoded into digit select
+ * and segments and kept as what the display shows.
+ *
+ * /sys/kernel/debug/led7-sim/ holds
+ *   display  the digits shown, as text and as raw patterns
+ *   expect   write a text the way /dev/led7controls takes it, reads back
+ *            whether the display shows it and how long that took
+ *   stats    frames, frame rate, shift time, latency, decode errors
+ *   capture  the recorded transitions: ns, line, value
+ *
+ * see led7-bench.sh for a check and benchmark of the driver on top.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/ctype.h>
+#include <linux/overflow.h>
+#include <linux/platform_device.h>
+#include <linux/property.h>
+#include <linux/gpio/driver.h>
+#include <linux/gpio/machine.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "led7.h"
+
+#define LED7_SIM_NAME		"led7-sim"
+#define LED7_SIM_DIGITS		8	/* per module */
+#define LED7_SIM_MAX_MODULES	(LED7_MAX_DIGITS / LED7_SIM_DIGITS)
+
+enum {
+	LED7_SIM_SCLK,
+	LED7_SIM_RCLK,
+	LED7_SIM_DIO,
+	LED7_SIM_LINES,
+};
+
+static unsigned int modules = 1;
+module_param(modules, uint, 0444);
+MODULE_PARM_DESC(modules, "number of daisy-chained modules (1-8)");
+
+static unsigned int capture_len = 65536;
+module_param(capture_len, uint, 0444);
+MODULE_PARM_DESC(capture_len, "transitions kept in the capture ring");
+
+static bool capture = true;
+module_param(capture, bool, 0644);
+MODULE_PARM_DESC(capture, "record transitions, clear it to read a stable capture");
+
+/* the glyphs of the driver, active low */
+static const char led7_sim_chars[] = "0123456789ABCDEF-.";
+static const u8 led7_sim_glyphs[] = {
+	0x03, 0x9F, 0x25, 0x0D, 0x99, 0x49, 0x41, 0x1F, 0x01,
+	0x09, 0x11, 0xC1, 0x63, 0x85, 0x61, 0x71, 0xFD, 0xFE,
+};
+
+struct led7_sim_edge {
+	u64	ts;
+	u8	line;
+	u8	value;
+};
+
+struct led7_sim {
+	struct gpio_chip	chip;
+	spinlock_t		lock;
+
+	/* all below protected by lock */
+	bool			line[LED7_SIM_LINES];
+	u16			sr[LED7_SIM_MAX_MODULES];
+	u8			shown[LED7_MAX_DIGITS];
+
+	struct led7_sim_edge	*ring;
+	unsigned int		ring_pos;	/* next entry to write */
+	unsigned int		ring_used;
+	u64			edges;
+
+	/* start of the shifting for the next latch, 0: none yet */
+	ktime_t			shift_start;
+	u64			shift_ns;
+
+	u64			latches;
+	u64			frames;
+	ktime_t			first_frame;
+	ktime_t			last_frame;
+	u64			decode_errors;
+
+	/* update to visible latency */
+	u8			expected[LED7_MAX_DIGITS];
+	bool			expect_pending;
+	ktime_t			expect_ts;
+	u64			latency_last;
+	u64			latency_min;
+	u64			latency_max;
+	u64			latency_sum;
+	u64			latencies;
+};
+
+static struct platform_device *led7_sim_pdev;
+static struct platform_device *led7_sim_led7_pdev;
+static struct gpiod_lookup_table *led7_sim_lookup;
+static struct dentry *led7_sim_debugfs;
+
+static u8 led7_sim_glyph(char c)
+{
+	const char *p = strchr(led7_sim_chars, toupper(c));
+
+	return c && p ? led7_sim_glyphs[p - led7_sim_chars] : LED7_BLANK;
+}
+
+static char led7_sim_char(u8 segments)
+{
+	unsigned int i;
+
+	if (segments == LED7_BLANK)
+		return ' ';
+	for (i = 0; i < ARRAY_SIZE(led7_sim_glyphs); i++)
+		if (led7_sim_glyphs[i] == segments)
+			return led7_sim_chars[i];
+
+	return '?';
+}
+
+/* called with sim->lock held on the rising edge of rclk */
+static void led7_sim_latch(struct led7_sim *sim, ktime_t now)
+{
+	unsigned int m, i, digits = modules * LED7_SIM_DIGITS;
+	u8 index, segments;
+
+	sim->latches++;
+	if (sim->shift_start) {
+		sim->shift_ns += ktime_to_ns(ktime_sub(now, sim->shift_start));
+		sim->shift_start = 0;
+	}
+
+	/* module 0 is nearest to the GPIOs and holds the word shifted last */
+	for (m = 0; m < modules; m++) {
+		index = sim->sr[m] >> 8;
+		segments = sim->sr[m] & 0xff;
+
+		if (!index) {
+			/* nothing selected, the module is dark */
+			for (i = 0; i < LED7_SIM_DIGITS; i++)
+				sim->shown[m * LED7_SIM_DIGITS + i] = LED7_BLANK;
+			continue;
+		}
+		if (hweight8(index) != 1) {
+			sim->decode_errors++;
+			continue;
+		}
+		/* 0x80 selects the rightmost digit */
+		sim->shown[m * LED7_SIM_DIGITS + __ffs(index)] = segments;
+	}
+
+	/* a frame starts with the rightmost digits */
+	if ((sim->sr[0] >> 8) == 0x80) {
+		if (!sim->frames)
+			sim->first_frame = now;
+		sim->last_frame = now;
+		sim->frames++;
+	}
+
+	if (sim->expect_pending &&
+	    !memcmp(sim->shown, sim->expected, digits)) {
+		u64 latency = ktime_to_ns(ktime_sub(now, sim->expect_ts));
+
+		sim->expect_pending = false;
+		sim->latency_last = latency;
+		if (!sim->latencies || latency < sim->latency_min)
+			sim->latency_min = latency;
+		if (latency > sim->latency_max)
+			sim->latency_max = latency;
+		sim->latency_sum += latency;
+		sim->latencies++;
+	}
+}
+
+/* called with sim->lock held on the rising edge of sclk */
+static void led7_sim_shift(struct led7_sim *sim)
+{
+	unsigned int m;
+
+	for (m = modules - 1; m > 0; m--)
+		sim->sr[m] = (sim->sr[m] >> 1) | ((sim->sr[m - 1] & 1) << 15);
+	sim->sr[0] = (sim->sr[0] >> 1) | (sim->line[LED7_SIM_DIO] << 15);
+}
+
+static int led7_sim_get_direction(struct gpio_chip *chip, unsigned int offset)
+{
+	/* 0: output, all of them */
+	return 0;
+}
+
+static int led7_sim_direction_input(struct gpio_chip *chip,
+						unsigned int offset)
+{
+	return -EPERM;
+}
+
+static int led7_sim_get(struct gpio_chip *chip, unsigned int offset)
+{
+	struct led7_sim *sim = gpiochip_get_data(chip);
+	unsigned long flags;
+	int value;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	value = sim->line[offset];
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return value;
+}
+
+static void led7_sim_set(struct gpio_chip *chip, unsigned int offset,
+								int value)
+{
+	struct led7_sim *sim = gpiochip_get_data(chip);
+	ktime_t now = ktime_get();
+	struct led7_sim_edge *edge;
+	unsigned long flags;
+	bool rising;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	if (sim->line[offset] == !!value) {
+		spin_unlock_irqrestore(&sim->lock, flags);
+		return;
+	}
+	rising = !sim->line[offset];
+	sim->line[offset] = !!value;
+
+	if (READ_ONCE(capture)) {
+		edge = &sim->ring[sim->ring_pos];
+		edge->ts = ktime_to_ns(now);
+		edge->line = offset;
+		edge->value = !!value;
+		if (++sim->ring_pos == capture_len)
+			sim->ring_pos = 0;
+		if (sim->ring_used < capture_len)
+			sim->ring_used++;
+	}
+	sim->edges++;
+
+	if (offset != LED7_SIM_RCLK && !sim->shift_start)
+		sim->shift_start = now;
+	if (rising && offset == LED7_SIM_SCLK)
+		led7_sim_shift(sim);
+	else if (rising && offset == LED7_SIM_RCLK)
+		led7_sim_latch(sim, now);
+	spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static int led7_sim_direction_output(struct gpio_chip *chip,
+					unsigned int offset, int value)
+{
+	led7_sim_set(chip, offset, value);
+
+	return 0;
+}
+
+static int led7_sim_display_show(struct seq_file *s, void *unused)
+{
+	struct led7_sim *sim = s->private;
+	unsigned int i, digits = modules * LED7_SIM_DIGITS;
+	u8 shown[LED7_MAX_DIGITS];
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	memcpy(shown, sim->shown, digits);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	for (i = 0; i < digits; i++)
+		seq_putc(s, led7_sim_char(shown[i]));
+	seq_putc(s, '\n');
+	for (i = 0; i < digits; i++)
+		seq_printf(s, "%02x%c", shown[i], i + 1 < digits ? ' ' : '\n');
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(led7_sim_display);
+
+static int led7_sim_expect_show(struct seq_file *s, void *unused)
+{
+	struct led7_sim *sim = s->private;
+	unsigned int i, digits = modules * LED7_SIM_DIGITS;
+	u8 expected[LED7_MAX_DIGITS];
+	unsigned long flags;
+	u64 latency;
+	bool pending;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	memcpy(expected, sim->expected, digits);
+	pending = sim->expect_pending;
+	latency = sim->latency_last;
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	for (i = 0; i < digits; i++)
+		seq_putc(s, led7_sim_char(expected[i]));
+	seq_putc(s, '\n');
+	seq_printf(s, "shown %s\n", pending ? "no" : "yes");
+	if (!pending)
+		seq_printf(s, "latency_ns %llu\n", latency);
+
+	return 0;
+}
+
+static int led7_sim_expect_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, led7_sim_expect_show, inode->i_private);
+}
+
+/* right aligned and blank padded, like a write() to the driver */
+static ssize_t led7_sim_expect_write(struct file *file,
+		const char __user *ubuf, size_t len, loff_t *ppos)
+{
+	struct led7_sim *sim = ((struct seq_file *)file->private_data)->private;
+	unsigned int i, digits = modules * LED7_SIM_DIGITS;
+	u8 expected[LED7_MAX_DIGITS];
+	char text[LED7_MAX_DIGITS + 1];
+	size_t n = min(len, sizeof(text));
+	unsigned long flags;
+
+	if (copy_from_user(text, ubuf, n))
+		return -EFAULT;
+	if (n && text[n - 1] == '\n')
+		n--;
+	if (n > digits)
+		return -EINVAL;
+
+	for (i = 0; i < digits; i++)
+		expected[digits - 1 - i] = i < n ?
+			led7_sim_glyph(text[n - 1 - i]) : LED7_BLANK;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	memcpy(sim->expected, expected, digits);
+	sim->expect_ts = ktime_get();
+	sim->expect_pending = true;
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return len;
+}
+
+static const struct file_operations led7_sim_expect_fops = {
+	.owner		= THIS_MODULE,
+	.open		= led7_sim_expect_open,
+	.read		= seq_read,
+	.write		= led7_sim_expect_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int led7_sim_stats_show(struct seq_file *s, void *unused)
+{
+	struct led7_sim *sim = s->private;
+	u64 edges, latches, frames, shift_ns, errors, span;
+	u64 lat_min, lat_max, lat_sum, lats, mhz = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	edges = sim->edges;
+	latches = sim->latches;
+	frames = sim->frames;
+	span = ktime_to_ns(ktime_sub(sim->last_frame, sim->first_frame));
+	shift_ns = sim->shift_ns;
+	errors = sim->decode_errors;
+	lat_min = sim->latency_min;
+	lat_max = sim->latency_max;
+	lat_sum = sim->latency_sum;
+	lats = sim->latencies;
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	/* frames per second in thousandths */
+	span = div_u64(span, 1000);
+	if (frames > 1 && span)
+		mhz = div64_u64((frames - 1) * NSEC_PER_SEC, span);
+
+	seq_printf(s, "transitions %llu\n", edges);
+	seq_printf(s, "latches %llu\n", latches);
+	seq_printf(s, "frames %llu\n", frames);
+	seq_printf(s, "fps %llu.%03llu\n", div_u64(mhz, 1000), mhz % 1000);
+	seq_printf(s, "shift_ns_per_frame %llu\n",
+				frames ? div64_u64(shift_ns, frames) : 0);
+	seq_printf(s, "decode_errors %llu\n", errors);
+	seq_printf(s, "updates %llu\n", lats);
+	seq_printf(s, "latency_min_ns %llu\n", lat_min);
+	seq_printf(s, "latency_avg_ns %llu\n", lats ? div64_u64(lat_sum, lats) : 0);
+	seq_printf(s, "latency_max_ns %llu\n", lat_max);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(led7_sim_stats);
+
+/* oldest first; only consistent while capture is clear */
+static void *led7_sim_capture_start(struct seq_file *s, loff_t *pos)
+{
+	struct led7_sim *sim = s->private;
+	unsigned int first;
+
+	if (*pos >= sim->ring_used)
+		return NULL;
+
+	first = sim->ring_used < capture_len ? 0 : sim->ring_pos;
+
+	return &sim->ring[(first + (unsigned int)*pos) % capture_len];
+}
+
+static void *led7_sim_capture_next(struct seq_file *s, void *v, loff_t *pos)
+{
+	++*pos;
+
+	return led7_sim_capture_start(s, pos);
+}
+
+static void led7_sim_capture_stop(struct seq_file *s, void *v)
+{
+}
+
+static int led7_sim_capture_show(struct seq_file *s, void *v)
+{
+	static const char * const names[] = { "sclk", "rclk", "dio" };
+	struct led7_sim_edge *edge = v;
+
+	seq_printf(s, "%llu %s %u\n", edge->ts, names[edge->line], edge->value);
+
+	return 0;
+}
+
+static const struct seq_operations led7_sim_capture_sops = {
+	.start	= led7_sim_capture_start,
+	.next	= led7_sim_capture_next,
+	.stop	= led7_sim_capture_stop,
+	.show	= led7_sim_capture_show,
+};
+
+static int led7_sim_capture_open(struct inode *inode, struct file *file)
+{
+	int ret;
+
+	ret = seq_open(file, &led7_sim_capture_sops);
+	if (!ret)
+		((struct seq_file *)file->private_data)->private =
+							inode->i_private;
+
+	return ret;
+}
+
+static const struct file_operations led7_sim_capture_fops = {
+	.owner		= THIS_MODULE,
+	.open		= led7_sim_capture_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+static int led7_sim_probe(struct platform_device *pdev)
+{
+	struct device *dev = &pdev->dev;
+	struct led7_sim *sim;
+	unsigned int i;
+	int ret;
+
+	sim = devm_kzalloc(dev, sizeof(*sim), GFP_KERNEL);
+	if (!sim)
+		return -ENOMEM;
+
+	sim->ring = vzalloc(array_size(capture_len, sizeof(*sim->ring)));
+	if (!sim->ring)
+		return -ENOMEM;
+
+	spin_lock_init(&sim->lock);
+	for (i = 0; i < LED7_MAX_DIGITS; i++) {
+		sim->shown[i] = LED7_BLANK;
+		sim->expected[i] = LED7_BLANK;
+	}
+
+	sim->chip.label = LED7_SIM_NAME;
+	sim->chip.parent = dev;
+	sim->chip.owner = THIS_MODULE;
+	sim->chip.base = -1;
+	sim->chip.ngpio = LED7_SIM_LINES;
+	sim->chip.can_sleep = false;
+	sim->chip.get_direction = led7_sim_get_direction;
+	sim->chip.direction_input = led7_sim_direction_input;
+	sim->chip.direction_output = led7_sim_direction_output;
+	sim->chip.get = led7_sim_get;
+	sim->chip.set = led7_sim_set;
+
+	ret = devm_gpiochip_add_data(dev, &sim->chip, sim);
+	if (ret) {
+		dev_err(dev, "failed to add GPIO chip: %d\n", ret);
+		vfree(sim->ring);
+		return ret;
+	}
+
+	platform_set_drvdata(pdev, sim);
+
+	debugfs_create_file("display", 0444, led7_sim_debugfs, sim,
+						&led7_sim_display_fops);
+	debugfs_create_file("expect", 0644, led7_sim_debugfs, sim,
+						&led7_sim_expect_fops);
+	debugfs_create_file("stats", 0444, led7_sim_debugfs, sim,
+						&led7_sim_stats_fops);
+	debugfs_create_file("capture", 0444, led7_sim_debugfs, sim,
+						&led7_sim_capture_fops);
+
+	return 0;
+}
+
+static int led7_sim_remove(struct platform_device *pdev)
+{
+	struct led7_sim *sim = platform_get_drvdata(pdev);
+
+	/* the files use the ring, the chip is gone right after this */
+	debugfs_remove_recursive(led7_sim_debugfs);
+	led7_sim_debugfs = NULL;
+	vfree(sim->ring);
+
+	return 0;
+}
+
+static struct platform_driver led7_sim_driver = {
+	.probe		= led7_sim_probe,
+	.remove		= led7_sim_remove,
+	.driver		= {
+		.name	= LED7_SIM_NAME,
+	},
+};
+
+/* lets the LED7 driver find sclk, rclk and dio on the simulator */
+static struct gpiod_lookup_table *led7_sim_lookup_alloc(void)
+{
+	static const char * const con_ids[] = { "sclk", "rclk", "dio" };
+	struct gpiod_lookup_table *table;
+	unsigned int i;
+
+	table = kzalloc(struct_size(table, table, LED7_SIM_LINES + 1),
+								GFP_KERNEL);
+	if (!table)
+		return NULL;
+
+	table->dev_id = "gpio_led7segment_sample";
+	for (i = 0; i < LED7_SIM_LINES; i++) {
+		table->table[i].chip_label = LED7_SIM_NAME;
+		table->table[i].chip_hwnum = i;
+		table->table[i].con_id = con_ids[i];
+		table->table[i].flags = GPIO_ACTIVE_HIGH;
+	}
+
+	return table;
+}
+
+static int __init led7_sim_init(void)
+{
+	struct property_entry props[] = {
+		PROPERTY_ENTRY_U32("phuongnam,chain-length", modules),
+		{ }
+	};
+	struct platform_device_info info = {
+		/* matches the LED7 driver by name */
+		.name		= "gpio_led7segment_sample",
+		.id		= PLATFORM_DEVID_NONE,
+		.properties	= props,
+	};
+	int ret;
+
+	if (!modules || modules > LED7_SIM_MAX_MODULES) {
+		pr_err(LED7_SIM_NAME ": modules must be 1-%d\n",
+						LED7_SIM_MAX_MODULES);
+		return -EINVAL;
+	}
+	if (!capture_len) {
+		pr_err(LED7_SIM_NAME ": capture_len must not be 0\n");
+		return -EINVAL;
+	}
+
+	led7_sim_debugfs = debugfs_create_dir(LED7_SIM_NAME, NULL);
+
+	ret = platform_driver_register(&led7_sim_driver);
+	if (ret)
+		goto err_debugfs;
+
+	led7_sim_pdev = platform_device_register_simple(LED7_SIM_NAME,
+						PLATFORM_DEVID_NONE, NULL, 0);
+	if (IS_ERR(led7_sim_pdev)) {
+		ret = PTR_ERR(led7_sim_pdev);
+		goto err_driver;
+	}
+
+	led7_sim_lookup = led7_sim_lookup_alloc();
+	if (!led7_sim_lookup) {
+		ret = -ENOMEM;
+		goto err_pdev;
+	}
+	gpiod_add_lookup_table(led7_sim_lookup);
+
+	led7_sim_led7_pdev = platform_device_register_full(&info);
+	if (IS_ERR(led7_sim_led7_pdev)) {
+		ret = PTR_ERR(led7_sim_led7_pdev);
+		goto err_lookup;
+	}
+
+	return 0;
+
+err_lookup:
+	gpiod_remove_lookup_table(led7_sim_lookup);
+	kfree(led7_sim_lookup);
+err_pdev:
+	platform_device_unregister(led7_sim_pdev);
+err_driver:
+	platform_driver_unregister(&led7_sim_driver);
+err_debugfs:
+	debugfs_remove_recursive(led7_sim_debugfs);
+	return ret;
+}
+
+static void __exit led7_sim_exit(void)
+{
+	platform_device_unregister(led7_sim_led7_pdev);
+	gpiod_remove_lookup_table(led7_sim_lookup);
+	kfree(led7_sim_lookup);
+	platform_device_unregister(led7_sim_pdev);
+	platform_driver_unregister(&led7_sim_driver);
+	debugfs_remove_recursive(led7_sim_debugfs);
+}
+
+module_init(led7_sim_init);
+module_exit(led7_sim_exit);
+
+MODULE_AUTHOR("Le Phuong Nam <le.phuong.nam@styl.solutions>");
+MODULE_DESCRIPTION("LED7 simulator on a GPIO chip for testing the LED7 driver");
+MODULE_LICENSE("GPL v2");
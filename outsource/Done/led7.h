@@ -0,0 +1,69 @@
+/*
+ * led7: interface of the /dev/led7controls char device
+ *
+ * shared between the kernel driver (led7gpio.c) and its userspace clients
+ *
+ * write() takes a string like the setled sysfs file does, right aligned
+ * and blank padded: 0-9, A-F, '-' and '.' have glyphs, anything else is
+ * blank and a trailing newline is dropped.
+ *
+ * segment patterns are active low, one bit per segment, the way the
+ * shift registers want them; LED7_BLANK turns a digit off. Digit 0 is
+ * the leftmost one of the whole chain of modules, eight digits each, the
+ * module wired to the GPIOs is the leftmost one. Arrays are sized for
+ * the longest chain, digits past the configured ones are ignored.
+ */
+#ifndef LED7_H
+#define LED7_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define LED7_IOCTL_TYPE 72
+#define LED7_MAX_DIGITS 64
+#define LED7_BLANK 0xff
+
+struct led7_raw {
+	__u8	segments[LED7_MAX_DIGITS];
+};
+
+/* shows the patterns of all digits at once */
+#define LED7_SET_RAW _IOW(LED7_IOCTL_TYPE,1,struct led7_raw)
+/* the patterns last set through write(), setled or the ioctls */
+#define LED7_GET_RAW _IOR(LED7_IOCTL_TYPE,2,struct led7_raw)
+
+/* changes the pattern of one digit, keeps the others */
+struct led7_digit {
+	__u8	digit;
+	__u8	segments;
+};
+
+#define LED7_SET_DIGIT _IOW(LED7_IOCTL_TYPE,3,struct led7_digit)
+
+/*
+ * turns the display off until the next update; the refresh stops unless
+ * the page below is mapped, then it goes on with blank digits so a
+ * change of seq shows again
+ */
+#define LED7_BLANK_ALL _IO(LED7_IOCTL_TYPE,4)
+
+/* the number of digits of the chain */
+#define LED7_GET_DIGITS _IOR(LED7_IOCTL_TYPE,5,__u32)
+
+/*
+ * one page can be mmap()ed writable (MAP_SHARED) for updates without
+ * any syscall. seq works like a seqcount: make it odd, write barrier,
+ * fill in segments, write barrier, make it even again. The refresh
+ * picks the patterns up at its next frame whenever seq is even and has
+ * changed; a copy during which seq moved is dropped and tried again
+ * with the next frame, so a frame never shows half of an update. An
+ * update through write() or the ioctls takes over again until seq
+ * changes next time.
+ */
+struct led7_mmap {
+	__u32	seq;
+	__u32	digits;		/* of the chain, set by the driver */
+	__u8	segments[LED7_MAX_DIGITS];
+};
+
+#endif /* LED7_H */
@@ -5,18 +5,36 @@
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/sched.h>  
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <uapi/linux/sched/types.h>     /* For struct sched_attr */
 #include <linux/platform_device.h>      /* For platform devices */
 #include <linux/interrupt.h>            /* For IRQ */
 #include <linux/gpio.h>                 /* For Legacy integer based GPIO */
 #include <linux/of_gpio.h>              /* For of_gpio* functions */
 #include <linux/of.h>                   /* For DT*/
+#include <linux/property.h>             /* For device_property_read_u32 */
+#include <linux/spi/spi.h>              /* For the SPI backend */
+#include <linux/bitrev.h>
+#include <linux/version.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "led7.h"
 
 #define DRIVER_NAME "led7control"
 #define FIRST_MINOR 0
+#define MINOR_COUNT 250
 #define BUFF_SIZE 100
 #define TEST_LED7 0
-#define USLEEP_RANGE_MIN 0
-#define USLEEP_RANGE_MAX 1000
+#define LED7_DIGITS 8                   /* per module, one per scan slot */
+#define LED7_MAX_MODULES (LED7_MAX_DIGITS / LED7_DIGITS)
+#define LED7_REFRESH_HZ 100             /* default, whole display */
+#define LED7_REFRESH_MIN_HZ 10
+#define LED7_REFRESH_MAX_HZ 1000
 
 #define PDEBUG(fmt,args...) printk(KERN_DEBUG"%s: "fmt,DRIVER_NAME, ##args)
 #define PERR(fmt,args...) printk(KERN_ERR"%s: "fmt,DRIVER_NAME,##args)
@@ -24,7 +42,70 @@
 
 int res; 
 bool thread_run = false;
-char buffs[9];
+
+/*
+ * modules daisy-chained on the same sclk/rclk/dio, from the
+ * "phuongnam,chain-length" DT property. Every scan slot shifts one word per module, the farthest one
+ * first, and latches them all at once, so each module shows its digit
+ * of the slot and a frame is still LED7_DIGITS slots long
+ */
+static unsigned int modules = 1;
+static unsigned int digits = LED7_DIGITS;
+
+/*
+ * a frame is the ready-to-shift words of every digit slot in shift order,
+ * segments in the low byte and digit select in the high one, word k of
+ * slot s at s * modules + k. Updates build the back frame
+ * and mark it pending, the scan thread flips to it at the start of a
+ * frame, so it never shows half of an update and never derives glyphs
+ */
+#define LED7_WORD(index, num) ((u16)(((index) << 8) | ((num) & 0xff)))
+#define FRAME_PENDING 2
+
+static u16 frames[2][LED7_MAX_DIGITS];
+static atomic_t frame_state;            /* front frame | FRAME_PENDING */
+static u8 raw[LED7_MAX_DIGITS];         /* last update, digit 0 leftmost */
+
+/*
+ * the mmap()able page and the frame the scan thread renders it into.
+ * Every mapping holds a reference of the page, so remove only drops
+ * the driver's one and the page stays until the last munmap()
+ */
+static struct led7_mmap *shared;
+static u16 shared_frame[LED7_MAX_DIGITS];
+static atomic_t mappings;
+
+/*
+ * scan engine: the thread lights one digit per slot and sleeps on an
+ * hrtimer until the next one, so every digit gets the same dwell time
+ * of 1 / (refresh_hz * LED7_DIGITS) and the core is free in between
+ */
+static unsigned int refresh_hz = LED7_REFRESH_HZ;
+static int priority;                    /* 0: SCHED_NORMAL, else SCHED_FIFO */
+static DEFINE_MUTEX(engine_lock);
+
+/*
+ * what the scan thread actually achieves, in debugfs led7control/stats
+ * and reset whenever it starts. dwell is the time a digit stays lit,
+ * latch to latch, shift the time spent pushing the words out and cpu
+ * the runtime of the thread, wakeups included
+ */
+struct scan_stats {
+    u64 frames;
+    ktime_t first_frame;
+    ktime_t last_frame;
+    u64 dwell_min;
+    u64 dwell_max;
+    u64 dwell_sum;
+    u64 dwells;
+    u64 missed;                         /* slots lost to stalls */
+    u64 shift_ns;
+    u64 cpu_ns;
+};
+
+static struct scan_stats stats;
+static DEFINE_SPINLOCK(stats_lock);
+static struct dentry *debugfs_dir;
 
 dev_t device_num ;
 struct class *device_class;
@@ -32,6 +113,8 @@ struct device *device;
 struct gpio_desc *sclk_gpio;
 struct gpio_desc *rclk_gpio;
 struct gpio_desc *dio_gpio;
+static struct spi_device *spi_dev;      /* set: SPI backend, else bit-bang */
+static u8 *spi_tx;                      /* DMA safe, 2 bytes per module */
 static struct task_struct *thread;
 static struct cdev cdev;
 
@@ -63,146 +146,608 @@ void set_rclk(void)
 	gpiod_set_value(rclk_gpio,1);
 }
 
-void set_num(int t_index, int t_num) 
+/*
+ * SPI backend: the words of all modules go out in one transfer, the shift
+ * register clock on SCK, its data on MOSI and the latch clock on chip
+ * select, whose rising edge at the end of the transfer latches them.
+ * Works with a hardware controller as well as with spi-gpio on the pins
+ * the bit-bang path uses. SPI sends msb first, the register wants the
+ * words lsb first, hence the bit reversal.
+ */
+static void spi_set_words(const u16 *words, int n)
+{
+    int i, ret;
+
+    for (i = 0; i < n; i++) {
+        spi_tx[2 * i] = bitrev8(words[i] & 0xff);
+        spi_tx[2 * i + 1] = bitrev8(words[i] >> 8);
+    }
+
+    ret = spi_write(spi_dev, spi_tx, 2 * n);
+    if (ret)
+        PERR("SPI write failed, error code: %d\n", ret);
+}
+
+/*
+ * shifts out n words, each segments then digit select, lsb first, and
+ * latches them together
+ */
+void set_words(const u16 *words, int n)
 {
-	int i = 0;
+	int i = 0, j;
 
-    for	(i = 0; i < 8; i++) {
-        // pr_info("DIOs:  %d", t_num & index_segment[7-i] ? 1 : 0);
-        gpiod_set_value(dio_gpio,t_num & index_segment[7-i] ? 1 : 0);
-		set_sclk();
-	}
+    if (spi_dev) {
+        spi_set_words(words, n);
+        return;
+    }
 
-    for	(i = 0; i < 8; i++) {
-        // pr_info("IDEs:  %d", t_index & index_segment[7-i] ? 1 : 0);
-        gpiod_set_value(dio_gpio, t_index & index_segment[7-i] ? 1 : 0);
-		set_sclk();
-	}
+    for (j = 0; j < n; j++)
+        for	(i = 0; i < 16; i++) {
+            gpiod_set_value(dio_gpio, (words[j] >> i) & 1);
+            set_sclk();
+        }
 
 	set_rclk();
 }
 
+void set_num(int t_index, int t_num) 
+{
+    u16 word = LED7_WORD(t_index, t_num);
+
+    set_words(&word, 1);
+}
+
 void clear_num(void)
 {
+    u16 blank[LED7_MAX_MODULES];
     int h = 0;
 
-    set_sclk(); 
-    set_rclk();
-    
-    for	(h = 0; h < 8; h++) {
-        gpiod_set_value(dio_gpio,0);
-        set_sclk();   
-    }
-    set_rclk();
+    /* no digit selected on any module */
+    for	(h = 0; h < modules; h++)
+        blank[h] = LED7_WORD(0, LED7_BLANK);
+    set_words(blank, modules);
+
+    if (spi_dev)
+        return;
 
     gpiod_set_value(dio_gpio,0);
     gpiod_set_value(sclk_gpio,0);
     gpiod_set_value(rclk_gpio,0);
 }
 
-void add_led(char *buff)
+/* segment pattern of c, blank for anything segment[] has no glyph for */
+static int glyph(char c)
+{
+    if (c >= '0' && c <= '9')
+        return segment[c - '0'];
+    if (c >= 'A' && c <= 'F')
+        return segment[c - 'A' + 10];
+    if (c >= 'a' && c <= 'f')
+        return segment[c - 'a' + 10];
+    if (c == '-')
+        return segment[16];
+    if (c == '.')
+        return segment[17];
+
+    return 0xFF;
+}
+
+/* takes the back frame for writing, called with engine_lock held */
+static u16 *frame_get_back(void)
+{
+    int state = atomic_read(&frame_state);
+    int old;
+
+    /* once pending is cleared the scan thread keeps its front frame */
+    while (state & FRAME_PENDING) {
+        old = atomic_cmpxchg(&frame_state, state, state & 1);
+        state = old == state ? state & 1 : old;
+    }
+
+    return frames[!state];
+}
+
+/* hands the back frame to the scan thread, called with engine_lock held */
+static void frame_put_back(void)
+{
+    int front = atomic_read(&frame_state) & 1;
+
+    atomic_set_release(&frame_state, front | FRAME_PENDING);
+}
+
+/* the frame to show next, flips to a pending one */
+static int frame_get_front(void)
+{
+    int state = atomic_read_acquire(&frame_state);
+
+    if ((state & FRAME_PENDING) &&
+        atomic_cmpxchg(&frame_state, state, !(state & 1)) == state)
+        return !(state & 1);
+
+    return state & 1;
+}
+
+/* slot 0 is the rightmost digit of each module, module 0 goes out last */
+static void frame_set_raw(u16 *frame, const u8 *segments)
+{
+    int slot, k, m;
+
+    for (slot = 0; slot < LED7_DIGITS; slot++)
+        for (k = 0; k < modules; k++) {
+            m = modules - 1 - k;
+            frame[slot * modules + k] = LED7_WORD(index_segment[slot],
+                    segments[m * LED7_DIGITS + LED7_DIGITS - 1 - slot]);
+        }
+}
+
+/* the glyphs of text right-aligned into raw, padded with pad */
+static void text_to_raw(const char *text, size_t len, u8 pad)
+{
+    int i;
+
+    for (i = 0; i < digits; i++)
+        raw[digits - 1 - i] = i < len ? glyph(text[len - 1 - i]) : pad;
+}
+
+/* sched_setscheduler*() are not exported to modules since 5.9 */
+static void apply_priority(struct task_struct *task)
+{
+    struct sched_attr attr = {
+        .size = sizeof(attr),
+        .sched_policy = priority ? SCHED_FIFO : SCHED_NORMAL,
+        .sched_priority = priority,
+    };
+
+    if (sched_setattr_nocheck(task, &attr))
+        PERR("Cannot set priority %d\n", priority);
+}
+
+/* books one slot which started shifting at start and latched at latch */
+static void stats_slot(int slot, ktime_t start, ktime_t latch, ktime_t prev, u64 cpu_start)
 {
-    set_num(index_segment[0], segment[buff[7]-48]);
-    usleep_range(USLEEP_RANGE_MIN, USLEEP_RANGE_MAX);
-    set_num(index_segment[1], segment[buff[6]-48]);
-    usleep_range(USLEEP_RANGE_MIN, USLEEP_RANGE_MAX);
-    set_num(index_segment[2], segment[buff[5]-48]);
-    usleep_range(USLEEP_RANGE_MIN, USLEEP_RANGE_MAX);
-    set_num(index_segment[3], segment[buff[4]-48]);
-    usleep_range(USLEEP_RANGE_MIN, USLEEP_RANGE_MAX);
-    set_num(index_segment[4], segment[buff[3]-48]);
-    usleep_range(USLEEP_RANGE_MIN, USLEEP_RANGE_MAX);
-    set_num(index_segment[5], segment[buff[2]-48]);
-    usleep_range(USLEEP_RANGE_MIN, USLEEP_RANGE_MAX);
-    set_num(index_segment[6], segment[buff[1]-48]);
-    usleep_range(USLEEP_RANGE_MIN, USLEEP_RANGE_MAX);
-    set_num(index_segment[7], segment[buff[0]-48]); 
-    usleep_range(USLEEP_RANGE_MIN, USLEEP_RANGE_MAX);
+    u64 dwell;
+
+    spin_lock(&stats_lock);
+    if (slot == 0) {
+        if (!stats.frames)
+            stats.first_frame = latch;
+        stats.last_frame = latch;
+        stats.frames++;
+    }
+    if (prev) {
+        dwell = ktime_to_ns(ktime_sub(latch, prev));
+        if (!stats.dwells || dwell < stats.dwell_min)
+            stats.dwell_min = dwell;
+        if (dwell > stats.dwell_max)
+            stats.dwell_max = dwell;
+        stats.dwell_sum += dwell;
+        stats.dwells++;
+    }
+    stats.shift_ns += ktime_to_ns(ktime_sub(latch, start));
+    stats.cpu_ns = current->se.sum_exec_runtime - cpu_start;
+    spin_unlock(&stats_lock);
 }
 
 int thread_function(void *pv)
 {
-    while(!kthread_should_stop()) {
-        add_led(buffs);
+    ktime_t expires = ktime_get();
+    ktime_t start, latch = 0, prev;
+    u64 cpu_start = current->se.sum_exec_runtime;
+    u64 slot_ns;
+    int slot = 0;
+    u16 *shown = frames[frame_get_front()];
+    u32 seen = smp_load_acquire(&shared->seq);
+    u32 seq;
+    u8 segments[LED7_MAX_DIGITS];
+
+    while (!kthread_should_stop()) {
+        /* updates only take effect at a frame boundary */
+        if (slot == 0) {
+            seq = smp_load_acquire(&shared->seq);
+            if (atomic_read(&frame_state) & FRAME_PENDING) {
+                shown = frames[frame_get_front()];
+            } else if (seq != seen && !(seq & 1)) {
+                /*
+                 * the mapped page changed since the last frame; seqcount
+                 * style, a copy which raced with the writer is dropped
+                 * and the page tried again with the next frame
+                 */
+                memcpy(segments, shared->segments, digits);
+                smp_rmb();
+                if (READ_ONCE(shared->seq) == seq) {
+                    seen = seq;
+                    frame_set_raw(shared_frame, segments);
+                    shown = shared_frame;
+                }
+            }
+        }
+        /* same work in every slot: one digit per module shifted and latched */
+        start = ktime_get();
+        set_words(&shown[slot * modules], modules);
+        prev = latch;
+        latch = ktime_get();
+        stats_slot(slot, start, latch, prev, cpu_start);
+        slot = (slot + 1) % LED7_DIGITS;
+
+        slot_ns = div_u64(NSEC_PER_SEC, READ_ONCE(refresh_hz) * LED7_DIGITS);
+        expires = ktime_add_ns(expires, slot_ns);
+        /* after a stall start over instead of rushing through slots */
+        if (ktime_before(expires, latch)) {
+            spin_lock(&stats_lock);
+            stats.missed += div64_u64(ktime_to_ns(ktime_sub(latch, expires)),
+                                      slot_ns) + 1;
+            spin_unlock(&stats_lock);
+            expires = latch;
+        }
+
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule_hrtimeout_range(&expires, 0, HRTIMER_MODE_ABS);
+        __set_current_state(TASK_RUNNING);
     }
 
-    do_exit(0);
     return 0;
 }
 
+/* called with engine_lock held */
+static int start_engine(void)
+{
+    if (thread_run)
+        return 0;
+
+    thread = kthread_create(thread_function, NULL, "led7-scan");
+    if (IS_ERR(thread)) {
+        PERR("Cannot create kthread\n");
+        return PTR_ERR(thread);
+    }
+    apply_priority(thread);
+    spin_lock(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    spin_unlock(&stats_lock);
+    thread_run = true;
+    wake_up_process(thread);
+    PINFO("Kthread Created Successfully...\n");
+
+    return 0;
+}
+
+/* called with engine_lock held */
+static void stop_engine(void)
+{
+    if (!thread_run)
+        return;
+
+    kthread_stop(thread);
+    thread_run = false;
+    clear_num();
+    PINFO("Stop thread\n");
+}
+
+/* shows raw with the next frame, called with engine_lock held */
+static int show_raw(void)
+{
+    frame_set_raw(frame_get_back(), raw);
+    frame_put_back();
+
+    return start_engine();
+}
+
+static ssize_t led7_write(struct file *file, const char __user *ubuf, size_t len, loff_t *off)
+{
+    char text[LED7_MAX_DIGITS + 1];
+    size_t n = min(len, sizeof(text));
+    int ret;
+
+    if (copy_from_user(text, ubuf, n))
+        return -EFAULT;
+    if (n && text[n - 1] == '\n')
+        n--;
+    if (n > digits)
+        return -EINVAL;
+
+    mutex_lock(&engine_lock);
+    text_to_raw(text, n, LED7_BLANK);
+    ret = show_raw();
+    mutex_unlock(&engine_lock);
+
+    return ret ? ret : len;
+}
+
+static long led7_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    void __user *uarg = (void __user *)arg;
+    struct led7_digit d;
+    struct led7_raw r;
+    u8 blank[LED7_MAX_DIGITS];
+    int ret = 0;
+
+    switch (cmd) {
+    case LED7_SET_RAW:
+        if (copy_from_user(&r, uarg, sizeof(r)))
+            return -EFAULT;
+        mutex_lock(&engine_lock);
+        memcpy(raw, r.segments, sizeof(raw));
+        ret = show_raw();
+        mutex_unlock(&engine_lock);
+        break;
+    case LED7_GET_RAW:
+        mutex_lock(&engine_lock);
+        memcpy(r.segments, raw, sizeof(raw));
+        mutex_unlock(&engine_lock);
+        if (copy_to_user(uarg, &r, sizeof(r)))
+            return -EFAULT;
+        break;
+    case LED7_SET_DIGIT:
+        if (copy_from_user(&d, uarg, sizeof(d)))
+            return -EFAULT;
+        if (d.digit >= digits)
+            return -EINVAL;
+        mutex_lock(&engine_lock);
+        raw[d.digit] = d.segments;
+        ret = show_raw();
+        mutex_unlock(&engine_lock);
+        break;
+    case LED7_BLANK_ALL:
+        mutex_lock(&engine_lock);
+        /*
+         * only the refresh watches the mapped page, so while it is
+         * mapped the refresh keeps running and shows a blank frame
+         * until seq changes
+         */
+        if (atomic_read(&mappings)) {
+            memset(blank, LED7_BLANK, sizeof(blank));
+            frame_set_raw(frame_get_back(), blank);
+            frame_put_back();
+        } else {
+            stop_engine();
+        }
+        mutex_unlock(&engine_lock);
+        break;
+    case LED7_GET_DIGITS:
+        return put_user(digits, (__u32 __user *)uarg);
+    default:
+        return -ENOTTY;
+    }
+
+    return ret;
+}
+
+static void led7_vm_open(struct vm_area_struct *vma)
+{
+    atomic_inc(&mappings);
+}
+
+static void led7_vm_close(struct vm_area_struct *vma)
+{
+    atomic_dec(&mappings);
+}
+
+static const struct vm_operations_struct led7_vm_ops = {
+    .open = led7_vm_open,
+    .close = led7_vm_close,
+};
+
+static int led7_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    int ret;
+
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE)
+        return -EINVAL;
+    /* private writable mappings are copy-on-write, updates got lost */
+    if ((vma->vm_flags & VM_WRITE) && !(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+
+    mutex_lock(&engine_lock);
+    /* the device is gone, the file is not */
+    if (!shared) {
+        ret = -ENODEV;
+        goto out;
+    }
+
+    /* takes a reference of the page for as long as it is mapped */
+    ret = vm_insert_page(vma, vma->vm_start, virt_to_page(shared));
+    if (ret)
+        goto out;
+
+    /* the refresh has to run for updates through the page to show */
+    ret = start_engine();
+    if (ret)
+        goto out;
+    vma->vm_ops = &led7_vm_ops;
+    led7_vm_open(vma);
+out:
+    mutex_unlock(&engine_lock);
+
+    return ret;
+}
+
+static int stats_show(struct seq_file *s, void *unused)
+{
+    struct scan_stats st;
+    u64 span, mhz = 0;
+
+    spin_lock(&stats_lock);
+    st = stats;
+    spin_unlock(&stats_lock);
+
+    /* frames per second in thousandths, over the frames since the start */
+    span = div_u64(ktime_to_ns(ktime_sub(st.last_frame, st.first_frame)), 1000);
+    if (st.frames > 1 && span)
+        mhz = div64_u64((st.frames - 1) * NSEC_PER_SEC, span);
+
+    seq_printf(s, "refresh_hz %u\n", READ_ONCE(refresh_hz));
+    seq_printf(s, "frames %llu\n", st.frames);
+    seq_printf(s, "fps %llu.%03llu\n", div_u64(mhz, 1000), mhz % 1000);
+    seq_printf(s, "dwell_min_ns %llu\n", st.dwell_min);
+    seq_printf(s, "dwell_avg_ns %llu\n",
+               st.dwells ? div64_u64(st.dwell_sum, st.dwells) : 0);
+    seq_printf(s, "dwell_max_ns %llu\n", st.dwell_max);
+    seq_printf(s, "missed_slots %llu\n", st.missed);
+    seq_printf(s, "shift_ns %llu\n", st.shift_ns);
+    seq_printf(s, "cpu_ns %llu\n", st.cpu_ns);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
 static struct file_operations fops =
 {
     .owner = THIS_MODULE,
+    .write = led7_write,
+    .unlocked_ioctl = led7_ioctl,
+    .mmap = led7_mmap,
 };
 
 static ssize_t setled_store(struct device *dev, struct device_attribute *attr, const char *buff, size_t len)
 {
     private_data_t *data = dev_get_drvdata(dev);
+    int ret = 0;
+
     if (!data)
         PERR("Can't get private data from device, pointer value: %p\n", data);
     else
         PINFO ("Set number %d\n", buff[0]);
     
-    if ((buff[0] == 's' && buff[1] == 't' && buff[2] == 'o' && buff[3] == 'p' && (len == 5)) || thread_run == true)
+    mutex_lock(&engine_lock);
+    if (buff[0] == 's' && buff[1] == 't' && buff[2] == 'o' && buff[3] == 'p' && (len == 5))
     {
-        thread_run = false;
-        clear_num();
-        PINFO("Stop thread\n");
-        kthread_stop(thread);
+        stop_engine();
+        mutex_unlock(&engine_lock);
+        return len;
     }
 
-    if (thread_run == false)
     {
-        int i = 0;
-
-        if ((len < 9) & (len > 0))
-        {
-            for (i = len; i >= 0; i--) buffs[i + 9 - len] = buff[i];
-            for (i = 0; i < 9 - len; i++) buffs[i] = 48;
-        } else 
-            for (i = 0; i < 9; i++) buffs[i] = buff[i];
-
-        thread_run = true;
-        thread = kthread_create(thread_function,NULL,"Thread_No_0");
-        if(thread) {
-            PINFO("Kthread Created Successfully...\n");
-            wake_up_process(thread);
-        } else {
-            PERR("Cannot create kthread\n");
-            return -1;
-        }
+        size_t n = len;
+
+        /* right aligned and padded with zeros, extra digits are cut off */
+        if (n && buff[n - 1] == '\n')
+            n--;
+        if (n > digits)
+            n = digits;
+
+        /* the scan thread picks the new frame up with its next one */
+        text_to_raw(buff, n, segment[0]);
+        ret = show_raw();
     }
+    mutex_unlock(&engine_lock);
 
-    return len;
+    return ret ? ret : len;
 } 
 
 static DEVICE_ATTR_WO(setled);
 
+static ssize_t refresh_hz_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%u\n", READ_ONCE(refresh_hz));
+}
+
+/* whole display refreshes per second, takes effect with the next slot */
+static ssize_t refresh_hz_store(struct device *dev, struct device_attribute *attr, const char *buff, size_t len)
+{
+    unsigned int hz;
+    int ret;
+
+    ret = kstrtouint(buff, 10, &hz);
+    if (ret)
+        return ret;
+    if (hz < LED7_REFRESH_MIN_HZ || hz > LED7_REFRESH_MAX_HZ)
+        return -EINVAL;
+
+    WRITE_ONCE(refresh_hz, hz);
+
+    return len;
+}
+
+static DEVICE_ATTR_RW(refresh_hz);
+
+static ssize_t priority_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%d\n", priority);
+}
+
+/* 0: SCHED_NORMAL, 1-99: SCHED_FIFO priority of the scan thread */
+static ssize_t priority_store(struct device *dev, struct device_attribute *attr, const char *buff, size_t len)
+{
+    int prio;
+    int ret;
+
+    ret = kstrtoint(buff, 10, &prio);
+    if (ret)
+        return ret;
+    if (prio < 0 || prio >= MAX_RT_PRIO)
+        return -EINVAL;
+
+    mutex_lock(&engine_lock);
+    priority = prio;
+    if (thread_run)
+        apply_priority(thread);
+    mutex_unlock(&engine_lock);
+
+    return len;
+}
+
+static DEVICE_ATTR_RW(priority);
+
 static struct attribute *device_attrs[] = {
         &dev_attr_setled.attr,
+        &dev_attr_refresh_hz.attr,
+        &dev_attr_priority.attr,
 	    NULL
 };
 ATTRIBUTE_GROUPS(device);
 
+/*
+ * led7-segments: a chain of 74HC595 based 8 digit modules
+ *
+ *   sclk-gpios, rclk-gpios, dio-gpios: the shift clock, latch and data
+ *     lines, not used as child of an SPI controller
+ *   phuongnam,chain-length: optional u32, the number of daisy-chained
+ *     modules, 1 (the default) to LED7_MAX_MODULES
+ */
 static const struct of_device_id gpio_dt_ids[] = {
     { .compatible = "led7-segments", },
     { /* sentinel */ }
 };
-static int my_pdrv_probe (struct platform_device *pdev)
+static int led7_probe(struct device *dev)
 {
-    res = alloc_chrdev_region(&device_num, FIRST_MINOR, 250, DRIVER_NAME); 
+    int ret;
+
+    // length of the chain, one module unless the DT says otherwise
+    modules = 1;
+    ret = device_property_read_u32(dev, "phuongnam,chain-length", &modules);
+    if (ret && ret != -EINVAL) {
+        PERR("Bad phuongnam,chain-length, error code: %d\n", ret);
+        return ret;
+    }
+    if (modules < 1 || modules > LED7_MAX_MODULES) {
+        PERR("Can't drive %u modules, at most %d\n", modules, LED7_MAX_MODULES);
+        return -EINVAL;
+    }
+    digits = modules * LED7_DIGITS;
+
+    res = alloc_chrdev_region(&device_num, FIRST_MINOR, MINOR_COUNT, DRIVER_NAME); 
     if (res){
         PERR("Can't register driver, error code: %d \n", res); 
+        ret = res;
         goto error;
     } else
         PINFO("success register driver with major is %d, minor is %d \n", MAJOR(device_num), MINOR(device_num));
     
+    shared = (struct led7_mmap *)get_zeroed_page(GFP_KERNEL);
+    if (!shared) {
+        PERR("Can't allocate the mmap page\n");
+        ret = -ENOMEM;
+        goto error_region;
+    }
+    shared->digits = digits;
+
     cdev_init(&cdev,&fops);
  
     // Adding character device to the system
-    if((cdev_add(&cdev,device_num,1)) < 0){
+    ret = cdev_add(&cdev,device_num,1);
+    if(ret < 0){
         PINFO("Cannot add the device to the system\n");
-        goto error_class;
+        goto error_page;
     }
 
     // create class 
@@ -210,7 +755,8 @@ static int my_pdrv_probe (struct platform_device *pdev)
     if (IS_ERR(device_class))
     {
         PERR("Class create failed, error code: %p\n", device_class);
-        goto error_class;
+        ret = PTR_ERR(device_class);
+        goto error_cdev;
     } else
 
     // create private data
@@ -221,18 +767,20 @@ static int my_pdrv_probe (struct platform_device *pdev)
     if (IS_ERR(device))
     {
         PERR("device create fall, error code: %p\n", device);
+        ret = PTR_ERR(device);
         goto error_device;
     }
 
-    // init gpio
-    sclk_gpio =  gpiod_get(&pdev->dev, "sclk", GPIOD_OUT_LOW);
-    rclk_gpio =  gpiod_get(&pdev->dev, "rclk", GPIOD_OUT_LOW);
-    dio_gpio =  gpiod_get(&pdev->dev, "dio", GPIOD_OUT_LOW);
+    // init gpio, the SPI controller owns them with the SPI backend
+    if (!spi_dev) {
+        sclk_gpio =  gpiod_get(dev, "sclk", GPIOD_OUT_LOW);
+        rclk_gpio =  gpiod_get(dev, "rclk", GPIOD_OUT_LOW);
+        dio_gpio =  gpiod_get(dev, "dio", GPIOD_OUT_LOW);
 
-    
-    gpiod_direction_output(sclk_gpio, 0);
-    gpiod_direction_output(rclk_gpio, 0);
-    gpiod_direction_output(dio_gpio, 0);
+        gpiod_direction_output(sclk_gpio, 0);
+        gpiod_direction_output(rclk_gpio, 0);
+        gpiod_direction_output(dio_gpio, 0);
+    }
     clear_num();
 
     // turn on TEST MODE at #define
@@ -248,6 +796,9 @@ static int my_pdrv_probe (struct platform_device *pdev)
     clear_num();
 #endif
 
+    debugfs_dir = debugfs_create_dir(DRIVER_NAME, NULL);
+    debugfs_create_file("stats", 0444, debugfs_dir, NULL, &stats_fops);
+
     PINFO("Start LED 7-segment driver!\n");
 	
     return 0;
@@ -263,26 +814,49 @@ error_reset_gpio:
 #endif
 
 error_device:
+    kfree(data);
     class_destroy(device_class);
-error_class:
-    unregister_chrdev_region(device_num, FIRST_MINOR); 
+error_cdev:
     cdev_del(&cdev);
+error_page:
+    free_page((unsigned long)shared);
+    shared = NULL;
+error_region:
+    unregister_chrdev_region(device_num, MINOR_COUNT); 
 error:
-    return -1;
+    return ret;
 }
-static int my_pdrv_remove(struct platform_device *pdev)
+static void led7_remove(void)
 {
+    debugfs_remove_recursive(debugfs_dir);
+    mutex_lock(&engine_lock);
+    stop_engine();
+    /* drops the driver's reference, mappings keep their own */
+    free_page((unsigned long)shared);
+    shared = NULL;
+    mutex_unlock(&engine_lock);
     clear_num();
-    if (thread_run == true) kthread_stop(thread);
-    gpiod_put(sclk_gpio);
-    gpiod_put(rclk_gpio);
-    gpiod_put(dio_gpio);
+    if (!spi_dev) {
+        gpiod_put(sclk_gpio);
+        gpiod_put(rclk_gpio);
+        gpiod_put(dio_gpio);
+    }
     device_destroy(device_class, device_num);
     class_destroy(device_class);
     cdev_del(&cdev);
-    unregister_chrdev_region(device_num, FIRST_MINOR); 
+    unregister_chrdev_region(device_num, MINOR_COUNT); 
     kfree(data);
     PINFO("Remove driver.\n");
+}
+
+static int my_pdrv_probe (struct platform_device *pdev)
+{
+    return led7_probe(&pdev->dev);
+}
+
+static int my_pdrv_remove(struct platform_device *pdev)
+{
+    led7_remove();
     return 0;
 }
 static struct platform_driver mydriver = {
@@ -294,6 +868,98 @@ static struct platform_driver mydriver = {
         .owner    = THIS_MODULE,
     },
 };
-module_platform_driver(mydriver);
+
+#if IS_ENABLED(CONFIG_SPI)
+/*
+ * the same display as child of an SPI controller, e.g.
+ *
+ *   spi-gpio: sck-gpios = <sclk>, mosi-gpios = <dio>, cs-gpios = <rclk>
+ *     led7@0 { compatible = "led7-segments"; reg = <0>; spi-max-frequency = <...>; };
+ *
+ * "phuongnam,chain-length" works the same as on the platform device
+ */
+static int led7_spi_probe(struct spi_device *spi)
+{
+    int ret;
+
+    spi_tx = devm_kzalloc(&spi->dev, 2 * LED7_MAX_MODULES, GFP_KERNEL);
+    if (!spi_tx)
+        return -ENOMEM;
+
+    spi->mode = SPI_MODE_0;
+    spi->bits_per_word = 8;
+    ret = spi_setup(spi);
+    if (ret) {
+        PERR("SPI setup failed, error code: %d\n", ret);
+        return ret;
+    }
+
+    spi_dev = spi;
+    ret = led7_probe(&spi->dev);
+    if (ret)
+        spi_dev = NULL;
+
+    return ret;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+static void led7_spi_remove(struct spi_device *spi)
+{
+    led7_remove();
+    spi_dev = NULL;
+}
+#else
+static int led7_spi_remove(struct spi_device *spi)
+{
+    led7_remove();
+    spi_dev = NULL;
+    return 0;
+}
+#endif
+
+static const struct spi_device_id led7_spi_ids[] = {
+    { "led7-segments", 0 },
+    { /* sentinel */ }
+};
+MODULE_DEVICE_TABLE(spi, led7_spi_ids);
+
+static struct spi_driver led7_spi_driver = {
+    .probe      = led7_spi_probe,
+    .remove     = led7_spi_remove,
+    .id_table   = led7_spi_ids,
+    .driver     = {
+        .name     = "gpio_led7segment_spi",
+        .of_match_table = of_match_ptr(gpio_dt_ids),
+    },
+};
+#endif
+
+static int __init led7_init(void)
+{
+    int ret;
+
+    ret = platform_driver_register(&mydriver);
+    if (ret)
+        return ret;
+
+#if IS_ENABLED(CONFIG_SPI)
+    ret = spi_register_driver(&led7_spi_driver);
+    if (ret)
+        platform_driver_unregister(&mydriver);
+#endif
+
+    return ret;
+}
+
+static void __exit led7_exit(void)
+{
+#if IS_ENABLED(CONFIG_SPI)
+    spi_unregister_driver(&led7_spi_driver);
+#endif
+    platform_driver_unregister(&mydriver);
+}
+
+module_init(led7_init);
+module_exit(led7_exit);
 MODULE_AUTHOR("Le Phuong Nam <le.phuong.nam@styl.solutions>");
 MODULE_LICENSE("GPL v2");
@@ -42,6 +42,89 @@
  *                           |<---------------------->|
  *                              pulse time measured
  *                              --> one round trip of ultra sonic waves
+ *
+ * besides the blocking READ_VALUE ioctl on /dev/srf05 the device can be
+ * used as an IIO triggered buffer: attach a trigger (e.g. an hrtimer
+ * trigger created through configfs), enable the distance and timestamp
+ * scan elements and the driver ranges on every trigger and pushes the
+ * samples into the kfifo behind /dev/iio:deviceX, from which many
+ * samples can be read with a single read()
+ *
+ * with engine_period_us set to a non-zero value the driver ranges on its
+ * own every period and publishes each result in a seqlock protected
+ * "latest sample" slot. READ_VALUE then just copies that slot instead of
+ * waiting for a cycle under data->lock. The engine only runs while at
+ * least one process has the char device open.
+ *
+ * every completed cycle is also appended to a per-device ring of
+ * struct srf05_record (see srf05.h). Each open file has its own read
+ * position in it, read() and the READ_BATCH ioctl drain all records
+ * pending for the file at once and poll() reports when there are some.
+ * The ring can also be mmap()ed and read without any copy_to_user, then
+ * poll() only serves as doorbell. START_MEASUREMENT and GET_RESULT split
+ * a single shot into a non-blocking request and its result, with poll()
+ * telling when it is there.
+ *
+ * the speed of sound follows the ambient temperature written to
+ * ambient_temp (m°C), and an optional filter stage (filter: none,
+ * median or ema over filter_window samples) cleans the results before
+ * they are published. With a filter active failed cycles are dropped
+ * instead of being handed out as errors, so readers only wake up for
+ * cleaned samples.
+ *
+ * every devantech,srf05 node gets its own instance and char device
+ * (/dev/srf05, /dev/srf05-1, ...). The pings of all instances are issued
+ * by one scheduler: an hrtimer fires the trigger of one sensor at a time,
+ * the echo interrupt completes the cycle and after a guard time
+ * (sched_guard_us) the next sensor in round-robin order which has a
+ * pending single shot or a due engine period is fired. So echos of
+ * different sensors never overlap, no matter how many sensors are
+ * mounted side by side.
+ *
+ * blocking readers do not queue up behind each other: a reader arriving
+ * while a ping of the device is in flight waits for that ping and shares
+ * its result, and with coalesce_us set a result younger than that is
+ * handed out without any ping at all.
+ *
+ * with governor_max_hz set the period of a running engine adapts to the
+ * scene instead of following engine_period_us: when successive
+ * distances change by more than governor_slope_high mm/s the engine
+ * pings at governor_max_hz right away, while they change by less than
+ * governor_slope_low mm/s the period doubles per sample down to
+ * governor_min_hz. governor_period_us shows the period in use. A static
+ * scene costs a few pings per second, an approaching object gets the
+ * full rate within one sample.
+ *
+ * max_range_mm limits the distances of interest: the echo of a ping is
+ * only waited for as long as it takes to come back from there, longer
+ * echos are rejected and the engine period and the quiet time after a
+ * ping shrink with it. Short range installations get proportionally more
+ * samples per second out of the same sensor.
+ *
+ * the distance channel has a rising and a falling threshold event, each
+ * with a hysteresis, evaluated on every published sample. An event fires
+ * once when the distance crosses the threshold and only fires again
+ * after the distance went back by more than the hysteresis, so a
+ * consumer can sleep on the IIO event fd until something changes.
+ * While an event is enabled it keeps the engine running like an open
+ * char device does; with engine_period_us at 0 the engine then runs
+ * every 100 ms (or the shortest period the range allows) until the
+ * events are disabled or a period is set.
+ *
+ * the echo edges are timestamped by the hardware timestamping engine
+ * (HTE) when the echo GPIO has one, the same way gpiolib does for line
+ * events with hardware timestamps; interrupt latency then no longer
+ * turns into distance error. HTE timestamps are in the clock of the
+ * provider, so they only give the pulse width; the record timestamp
+ * and the trigger latency stay ktime_get() of the capture path, which
+ * without HTE takes both in the interrupt handler as before. Which way
+ * is used and the jitter seen between the trigger and the rising echo
+ * edge is in the debugfs file capture.
+ *
+ * /sys/kernel/debug/srf05/<dev>/ holds log2 histograms of the trigger to
+ * echo latency, the echo pulse width, the wait for data->lock and the
+ * ioctl latency, plus counters of timeouts, out of range echos and
+ * waits cut short by a signal.
  */
 #include <linux/err.h>
 #include <linux/gpio/consumer.h>
@@ -55,6 +138,10 @@
 #include <linux/delay.h>
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/events.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <linux/ioctl.h>
 #include <linux/cdev.h>
 #include <linux/fs.h>
@@ -63,216 +150,2108 @@
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/kdev_t.h>
+#include <linux/hrtimer.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/idr.h>
+#include <linux/math64.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#if IS_ENABLED(CONFIG_HTE)
+#include <linux/hte.h>
+#endif
+
+#include "srf05.h"
+
+#define MAX_DEV 8
+#define FIRST_MINOR 0
+
+/* the sensor cannot see further than 4 m or closer than 1 cm */
+#define SRF05_MAX_RANGE_MM		4000
+#define SRF05_MIN_RANGE_MM		10
+
+/* the echo goes high well within 1 ms after the trigger */
+#define SRF05_TRIGGER_LATENCY_US	1000
+
+/* poll interval for a sensor still busy with an echo from beyond range */
+#define SRF05_BUSY_RETRY_US		1000
+
+/* records kept per device for read() and READ_BATCH, a power of 2 */
+#define SRF05_RING_SIZE			256
+
+/* header page plus the records, the size of the mmap()able area */
+#define SRF05_RING_BYTES	(PAGE_SIZE + PAGE_ALIGN(SRF05_RING_SIZE * \
+					sizeof(struct srf05_record)))
+
+/* records copied to userspace per round */
+#define SRF05_FETCH_CHUNK		8
+
+/* samples the median or the moving average is taken over, at most */
+#define SRF05_FILTER_MAX_WINDOW		15
+
+/* bucket i > 0 counts [2^(i-1), 2^i) ns, the last one everything above */
+#define SRF05_HIST_BUCKETS		32
+
+/* rates are averaged over windows of this length */
+#define SRF05_RATE_WINDOW_NS		NSEC_PER_SEC
+
+/* engine period for enabled events while engine_period_us is 0 */
+#define SRF05_EVENT_PERIOD_MS		100
+
+static unsigned int sched_guard_us = 10000;
+module_param(sched_guard_us, uint, 0644);
+MODULE_PARM_DESC(sched_guard_us,
+	"quiet time after an echo before any sensor is pinged again (us), "
+	"at most the echo time of the max_range_mm of the sensor");
+
+enum srf05_filter {
+	SRF05_FILTER_NONE,
+	SRF05_FILTER_MEDIAN,
+	SRF05_FILTER_EMA,
+};
+
+static const char * const srf05_filter_names[] = {
+	[SRF05_FILTER_NONE]	= "none",
+	[SRF05_FILTER_MEDIAN]	= "median",
+	[SRF05_FILTER_EMA]	= "ema",
+};
+
+static dev_t dev_num_t;
+static struct class *srf05_class;
+static DEFINE_IDA(srf05_ida);
+static struct dentry *srf05_debugfs;
+
+struct srf05_hist {
+	atomic_long_t		bucket[SRF05_HIST_BUCKETS];
+};
+
+struct srf05_rate {
+	u64			count;
+	u64			win_count;
+	ktime_t			win_start;
+	u32			millihz;
+};
+
+/* one threshold event of the distance channel, values in mm */
+struct srf05_thresh {
+	unsigned int		value;
+	unsigned int		hyst;
+	bool			enabled;
+	bool			armed;
+};
+
+struct srf05_data {
+	struct device		*dev;
+	struct iio_dev		*indio_dev;
+	struct gpio_desc	*gpiod_trig;
+	struct gpio_desc	*gpiod_echo;
+	struct mutex		lock;
+	int			irqnr;
+	ktime_t			ts_trigger;
+	ktime_t			ts_rising;
+	u64			hw_rising;	/* ns, clock of the HTE provider */
+
+	/*
+	 * echo capture: HTE timestamps or interrupt time; trigger to
+	 * rising edge latency and its mean deviation as EWMA in ns,
+	 * protected by srf05_sched.lock
+	 */
+	bool			hte;
+#if IS_ENABLED(CONFIG_HTE)
+	struct hte_ts_desc	hte_desc;
+#endif
+	int			lat_mean;
+	int			lat_jitter;
+
+	/*
+	 * char device; open files hold the cdev, which holds indio_dev and
+	 * so data. dead: the sensor is gone, set under lock at unbind, the
+	 * ring is then freed by the last release
+	 */
+	int			id;
+	struct cdev		cdev;
+	struct device		*chrdev;
+	bool			dead;
+
+	/*
+	 * scheduling state, protected by srf05_sched.lock
+	 */
+	struct list_head	node;
+	bool			oneshot;
+	bool			echo_started;
+	bool			engine_running;
+	ktime_t			next_due;
+	struct srf05_rate	rate;
+	u32			cycle_seq;
+	unsigned int		async_waiters;
+
+	/*
+	 * range, conversion and filter stage, also protected by
+	 * srf05_sched.lock
+	 */
+	unsigned int		max_range_mm;
+	u64			echo_max_ns;
+	ktime_t			cycle_timeout;
+	int			temp_mc;
+	u32			speed_mmps;
+	enum srf05_filter	filter;
+	unsigned int		filter_window;
+	unsigned int		filter_count;
+	unsigned int		filter_pos;
+	int			filter_buf[SRF05_FILTER_MAX_WINDOW];
+	s32			filter_ema;	/* 1/256 mm */
+
+	/*
+	 * rate governor of the engine, also protected by srf05_sched.lock;
+	 * off while gov_max_hz is 0, slopes in mm/s
+	 */
+	unsigned int		gov_min_hz;
+	unsigned int		gov_max_hz;
+	unsigned int		gov_slope_low;
+	unsigned int		gov_slope_high;
+	ktime_t			gov_period;
+	bool			gov_valid;
+	int			gov_last;
+	ktime_t			gov_last_ts;
+
+	/* threshold events, also protected by srf05_sched.lock */
+	struct srf05_thresh	thresh_rising;
+	struct srf05_thresh	thresh_falling;
+
+	/*
+	 * engine configuration and users, protected by lock; enabled
+	 * events count as one user. event_period: period was 0 and set to
+	 * SRF05_EVENT_PERIOD_MS for the events, back to 0 once they are off
+	 */
+	ktime_t			period;
+	int			users;
+	bool			event_user;
+	bool			event_period;
+
+	/* results younger than this are shared by blocking readers */
+	ktime_t			coalesce;
+
+	/*
+	 * ring of the last samples; written by the scheduler under the
+	 * writer side of sample_lock, readers use the lockless seqlock read
+	 * side. sample_seq is the number of records ever written, the
+	 * latest one is at sample_seq - 1
+	 */
+	seqlock_t		sample_lock;
+	wait_queue_head_t	sample_wq;
+	bool			sample_valid;
+	u32			sample_seq;
+	struct srf05_ring_header *ring_hdr;
+	struct srf05_record	*ring;
+
+	/* statistics under debugfs */
+	struct dentry		*debugfs;
+	struct srf05_hist	hist_rising;
+	struct srf05_hist	hist_echo;
+	struct srf05_hist	hist_lock;
+	struct srf05_hist	hist_ioctl;
+	atomic_long_t		timeouts;
+	atomic_long_t		range_errors;
+	atomic_long_t		killed_waits;
+
+	/*
+	 * buffer for one scan: distance and timestamp; scan_next is the
+	 * seq of the next record to push, older ones are already in
+	 */
+	struct {
+		u16		distance;
+		s64		timestamp __aligned(8);
+	} scan;
+	u32			scan_next;
+};
+
+/*
+ * all sensors share the air: only one of them may have a ping in flight
+ */
+static struct srf05_sched {
+	spinlock_t		lock;
+	struct list_head	sensors;
+	struct srf05_data	*owner;
+	ktime_t			deadline;
+	ktime_t			quiet_until;
+	struct hrtimer		timer;
+	struct srf05_rate	rate;
+} srf05_sched;
+
+/* one per open file of the char device */
+struct srf05_file {
+	struct srf05_data	*data;
+	struct mutex		lock;
+	u32			next_seq;
+	bool			mapped;
+	bool			async_pending;
+	u32			async_seq;
+};
+
+static int srf05_open(struct inode *inode, struct file *file);
+static int srf05_release(struct inode *inode, struct file *file);
+static long srf05_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static ssize_t srf05_fread(struct file *file, char __user *buf, size_t len,
+								loff_t *off);
+static unsigned int srf05_poll(struct file *file, poll_table *wait);
+static int srf05_mmap(struct file *file, struct vm_area_struct *vma);
+
+static struct file_operations fops = {
+	.owner = THIS_MODULE,
+	.open       = srf05_open,
+    .release    = srf05_release,
+    .unlocked_ioctl = srf05_ioctl,
+	.read		= srf05_fread,
+	.poll		= srf05_poll,
+	.mmap		= srf05_mmap,
+	.llseek		= no_llseek,
+};
+
+/* one lockless increment, cheap enough for the interrupt path */
+static void srf05_hist_add(struct srf05_hist *hist, s64 ns)
+{
+	int i = ns > 0 ? fls64(ns) : 0;
+
+	if (i >= SRF05_HIST_BUCKETS)
+		i = SRF05_HIST_BUCKETS - 1;
+
+	atomic_long_inc(&hist->bucket[i]);
+}
+
+static void srf05_hist_since(struct srf05_hist *hist, ktime_t start)
+{
+	srf05_hist_add(hist, ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+/* speed of sound in mm/s at temp_mc m°C */
+static u32 srf05_speed(int temp_mc)
+{
+	/*
+	 * the speed as function of the temperature is approximately:
+	 *
+	 * speed = 331,5 + 0,6 * Temp
+	 *   with Temp in °C
+	 *   and speed in m/s
+	 *
+	 * ==> 331500 mm/s + 0,6 mm/s per m°C
+	 */
+	return 331500 + temp_mc * 6 / 10;
+}
+
+/* called with srf05_sched.lock held */
+static void srf05_set_range(struct srf05_data *data, unsigned int range_mm)
+{
+	/*
+	 * echos from beyond max_range_mm are not of interest
+	 * ==> filter out invalid results for not measuring echos of
+	 *     another us sensor and stop waiting for them
+	 *
+	 * formula:
+	 *         2 * distance     2 * 2 m
+	 * time = -------------- = --------- = 12539185 ns
+	 *            speed         319 m/s
+	 *
+	 * using a minimum speed at -20 °C of 319 m/s; the default of 2 m
+	 * is the limit this driver always used
+	 */
+	data->max_range_mm = range_mm;
+	data->echo_max_ns = div_u64((u64)range_mm * 2 * NSEC_PER_SEC, 319000);
+	data->cycle_timeout = ktime_add_ns(
+			us_to_ktime(SRF05_TRIGGER_LATENCY_US), data->echo_max_ns);
+}
+
+/*
+ * called with srf05_sched.lock held; the sound of a ping has come back
+ * from max_range_mm after echo_max_ns, so waiting longer than that
+ * before the next ping does not help against crosstalk
+ */
+static ktime_t srf05_guard(struct srf05_data *data)
+{
+	return ns_to_ktime(min_t(u64, (u64)sched_guard_us * NSEC_PER_USEC,
+							data->echo_max_ns));
+}
+
+/* called with srf05_sched.lock held */
+static ktime_t srf05_min_period(struct srf05_data *data)
+{
+	return ktime_add(data->cycle_timeout, srf05_guard(data));
+}
+
+/* called with srf05_sched.lock held, bounds of the governed period */
+static ktime_t srf05_gov_fast(struct srf05_data *data)
+{
+	ktime_t fast = ns_to_ktime(div_u64(NSEC_PER_SEC, data->gov_max_hz));
+
+	return ktime_before(fast, srf05_min_period(data)) ?
+					srf05_min_period(data) : fast;
+}
+
+static ktime_t srf05_gov_slow(struct srf05_data *data)
+{
+	ktime_t slow = ns_to_ktime(div_u64(NSEC_PER_SEC, data->gov_min_hz));
+
+	return ktime_before(slow, srf05_gov_fast(data)) ?
+					srf05_gov_fast(data) : slow;
+}
+
+/* called with srf05_sched.lock held, starts over at the full rate */
+static void srf05_gov_reset(struct srf05_data *data)
+{
+	data->gov_valid = false;
+	if (data->gov_max_hz)
+		data->gov_period = srf05_gov_fast(data);
+}
+
+/* the engine period in use; lockless callers get a snapshot */
+static ktime_t srf05_engine_period(struct srf05_data *data)
+{
+	if (READ_ONCE(data->gov_max_hz))
+		return READ_ONCE(data->gov_period);
+
+	return READ_ONCE(data->period);
+}
+
+/* called with srf05_sched.lock held */
+static int srf05_distance(struct srf05_data *data, u64 dt_ns)
+{
+	if (dt_ns > data->echo_max_ns)
+		return -EIO;
+
+	/*
+	 * the speed is derived from ambient_temp, without it 26 °C are
+	 * assumed which gives the 347 m/s used before
+	 *
+	 * therefore:
+	 *             time     speed
+	 * distance = ------ * -------
+	 *             10^9       2
+	 *   with time in ns
+	 *   speed in mm/s
+	 *   and distance in mm (one way)
+	 */
+	return div_u64(dt_ns * data->speed_mmps, 2000000000);
+}
+
+/*
+ * called with srf05_sched.lock held for every valid distance while a
+ * filter is active, returns the filtered distance
+ */
+static int srf05_filter(struct srf05_data *data, int distance)
+{
+	int sorted[SRF05_FILTER_MAX_WINDOW];
+	unsigned int i, j;
+	int v;
+
+	switch (data->filter) {
+	case SRF05_FILTER_MEDIAN:
+		data->filter_buf[data->filter_pos] = distance;
+		data->filter_pos = (data->filter_pos + 1) % data->filter_window;
+		if (data->filter_count < data->filter_window)
+			data->filter_count++;
+
+		/* insertion sort of at most 15 values */
+		for (i = 0; i < data->filter_count; i++) {
+			v = data->filter_buf[i];
+			for (j = i; j > 0 && sorted[j - 1] > v; j--)
+				sorted[j] = sorted[j - 1];
+			sorted[j] = v;
+		}
+		return sorted[data->filter_count / 2];
+	case SRF05_FILTER_EMA:
+		if (!data->filter_count++)
+			data->filter_ema = distance << 8;
+		else
+			data->filter_ema += ((distance << 8) - data->filter_ema) /
+					(int)data->filter_window;
+		return (data->filter_ema + 128) >> 8;
+	default:
+		return distance;
+	}
+}
+
+static void srf05_rate_account(struct srf05_rate *rate, ktime_t now)
+{
+	s64 elapsed = ktime_to_ns(ktime_sub(now, rate->win_start));
+
+	rate->count++;
+	if (elapsed < SRF05_RATE_WINDOW_NS)
+		return;
+
+	rate->millihz = div64_u64((rate->count - rate->win_count) *
+					NSEC_PER_SEC * 1000, elapsed);
+	rate->win_count = rate->count;
+	rate->win_start = now;
+}
+
+static u32 srf05_rate_get(struct srf05_rate *rate, ktime_t now)
+{
+	s64 elapsed = ktime_to_ns(ktime_sub(now, rate->win_start));
+
+	/* no window closed for a while: the last result is stale */
+	if (elapsed >= 2 * SRF05_RATE_WINDOW_NS)
+		return div64_u64((rate->count - rate->win_count) *
+					NSEC_PER_SEC * 1000, elapsed);
+
+	return rate->millihz;
+}
+
+/* called with srf05_sched.lock held */
+static void srf05_sched_arm(ktime_t expires)
+{
+	hrtimer_start(&srf05_sched.timer, expires, HRTIMER_MODE_ABS);
+}
+
+/* called with srf05_sched.lock held and no ping in flight */
+static void srf05_sched_next(ktime_t now)
+{
+	struct srf05_data *data;
+	ktime_t wake = KTIME_MAX;
+
+	if (ktime_before(now, srf05_sched.quiet_until)) {
+		srf05_sched_arm(srf05_sched.quiet_until);
+		return;
+	}
+
+	/*
+	 * fired sensors are moved to the tail, so walking from the head
+	 * picks the one waiting longest ==> round-robin
+	 */
+	list_for_each_entry(data, &srf05_sched.sensors, node) {
+		if (!data->oneshot) {
+			if (!data->engine_running)
+				continue;
+			if (ktime_before(now, data->next_due)) {
+				if (ktime_before(data->next_due, wake))
+					wake = data->next_due;
+				continue;
+			}
+		}
+
+		/*
+		 * the sensor ignores the trigger while its echo line is
+		 * still high from a ping we gave up beyond max_range_mm
+		 */
+		if (gpiod_get_value(data->gpiod_echo)) {
+			ktime_t retry = ktime_add_us(now, SRF05_BUSY_RETRY_US);
+
+			if (ktime_before(retry, wake))
+				wake = retry;
+			continue;
+		}
+
+		if (data->engine_running &&
+				!ktime_before(now, data->next_due)) {
+			ktime_t period = srf05_engine_period(data);
+
+			data->next_due = ktime_add(data->next_due, period);
+			if (ktime_before(data->next_due, now))
+				data->next_due = ktime_add(now, period);
+		}
+		goto fire;
+	}
+
+	if (wake != KTIME_MAX)
+		srf05_sched_arm(wake);
+	return;
+
+fire:
+	data->oneshot = false;
+	data->echo_started = false;
+	list_move_tail(&data->node, &srf05_sched.sensors);
+
+	srf05_sched.owner = data;
+	srf05_sched.deadline = ktime_add(now, data->cycle_timeout);
+	srf05_sched_arm(srf05_sched.deadline);
+
+	gpiod_set_value(data->gpiod_trig, 1);
+	udelay(10);
+	gpiod_set_value(data->gpiod_trig, 0);
+
+	/* the burst starts with the falling edge of the trigger */
+	data->ts_trigger = ktime_get();
+}
+
+/*
+ * called with srf05_sched.lock held after new work showed up; re-evaluates
+ * the queue so the timer never sleeps past the new request
+ */
+static void srf05_sched_kick(void)
+{
+	if (srf05_sched.owner)
+		return;
+
+	srf05_sched_next(ktime_get());
+}
+
+/*
+ * called with srf05_sched.lock held for every published distance; a
+ * fired threshold is armed again once the distance is back by more than
+ * the hysteresis
+ */
+static void srf05_thresh_check(struct srf05_data *data, int distance)
+{
+	struct srf05_thresh *rising = &data->thresh_rising;
+	struct srf05_thresh *falling = &data->thresh_falling;
+
+	if (rising->enabled) {
+		if (rising->armed && distance > rising->value) {
+			rising->armed = false;
+			iio_push_event(data->indio_dev,
+				IIO_UNMOD_EVENT_CODE(IIO_DISTANCE, 0,
+					IIO_EV_TYPE_THRESH, IIO_EV_DIR_RISING),
+				iio_get_time_ns(data->indio_dev));
+		} else if (distance + rising->hyst < rising->value) {
+			rising->armed = true;
+		}
+	}
+
+	if (falling->enabled) {
+		if (falling->armed && distance < falling->value) {
+			falling->armed = false;
+			iio_push_event(data->indio_dev,
+				IIO_UNMOD_EVENT_CODE(IIO_DISTANCE, 0,
+					IIO_EV_TYPE_THRESH, IIO_EV_DIR_FALLING),
+				iio_get_time_ns(data->indio_dev));
+		} else if (distance > falling->value + falling->hyst) {
+			falling->armed = true;
+		}
+	}
+}
+
+/*
+ * called with srf05_sched.lock held for every published distance of a
+ * running engine: fast changes get the full rate at once, a stable
+ * scene backs off step by step
+ */
+static void srf05_gov_update(struct srf05_data *data, int distance,
+						ktime_t ts, ktime_t now)
+{
+	s64 dt = ktime_to_ns(ktime_sub(ts, data->gov_last_ts));
+	u64 slope;
+
+	if (data->gov_valid && dt > 0) {
+		slope = div64_u64((u64)abs(distance - data->gov_last) *
+							NSEC_PER_SEC, dt);
+		if (slope >= data->gov_slope_high) {
+			data->gov_period = srf05_gov_fast(data);
+			/* the ping already scheduled may be too late now */
+			if (ktime_before(ktime_add(now, data->gov_period),
+							data->next_due))
+				data->next_due = ktime_add(now,
+							data->gov_period);
+		} else if (slope <= data->gov_slope_low) {
+			data->gov_period = ktime_add(data->gov_period,
+							data->gov_period);
+			if (ktime_after(data->gov_period, srf05_gov_slow(data)))
+				data->gov_period = srf05_gov_slow(data);
+		}
+	}
+
+	data->gov_valid = true;
+	data->gov_last = distance;
+	data->gov_last_ts = ts;
+}
+
+/* called with srf05_sched.lock held, finishes the ping of the owner */
+static void srf05_sched_complete(struct srf05_data *data, int distance,
+						ktime_t ts, ktime_t now)
+{
+	struct srf05_record *rec;
+
+	srf05_sched.owner = NULL;
+	srf05_sched.quiet_until = ktime_add(now, srf05_guard(data));
+
+	data->cycle_seq++;
+	if (distance == -ETIMEDOUT)
+		atomic_long_inc(&data->timeouts);
+	else if (distance == -EIO)
+		atomic_long_inc(&data->range_errors);
+	srf05_rate_account(&data->rate, now);
+	srf05_rate_account(&srf05_sched.rate, now);
+
+	if (data->filter != SRF05_FILTER_NONE) {
+		/*
+		 * failed cycles are not published; nobody waits in the
+		 * driver for asynchronous requests, so ping again for them
+		 */
+		if (distance < 0) {
+			if (data->async_waiters)
+				data->oneshot = true;
+			goto out;
+		}
+		distance = srf05_filter(data, distance);
+	}
+
+	write_seqlock(&data->sample_lock);
+	rec = &data->ring[data->sample_seq & (SRF05_RING_SIZE - 1)];
+	rec->distance = distance < 0 ? 0 : distance;
+	rec->status = distance < 0 ? distance : 0;
+	rec->seq = data->sample_seq;
+	rec->timestamp = ktime_to_ns(ts);
+	data->sample_seq++;
+	data->sample_valid = true;
+	data->async_waiters = 0;
+	/*
+	 * publish to the mmap consumers; the smp_wmb() of the next
+	 * write_seqlock() orders this before the record is reused
+	 */
+	smp_store_release(&data->ring_hdr->head, data->sample_seq);
+	write_sequnlock(&data->sample_lock);
+
+	if (distance >= 0) {
+		srf05_thresh_check(data, distance);
+		if (data->engine_running && data->gov_max_hz)
+			srf05_gov_update(data, distance, ts, now);
+	}
+
+out:
+	/*
+	 * blocking readers in the driver also need to see dropped cycles to
+	 * ping again, poll() stays quiet for them
+	 */
+	wake_up_interruptible(&data->sample_wq);
+
+	srf05_sched_next(now);
+}
+
+static enum hrtimer_restart srf05_sched_tick(struct hrtimer *timer)
+{
+	unsigned long flags;
+	ktime_t now;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	now = ktime_get();
+
+	if (srf05_sched.owner) {
+		/* woken up early by a kick, the ping is still in flight */
+		if (ktime_before(now, srf05_sched.deadline)) {
+			srf05_sched_arm(srf05_sched.deadline);
+			goto out;
+		}
+		/*
+		 * no echo at all or one from beyond max_range_mm, which is
+		 * not waited for
+		 */
+		srf05_sched_complete(srf05_sched.owner,
+				srf05_sched.owner->echo_started ?
+				-EIO : -ETIMEDOUT, now, now);
+	} else {
+		srf05_sched_next(now);
+	}
+
+out:
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+static void srf05_sched_add(struct srf05_data *data)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	list_add_tail(&data->node, &srf05_sched.sensors);
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+}
+
+static void srf05_sched_del(struct srf05_data *data)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	list_del(&data->node);
+	if (srf05_sched.owner == data) {
+		srf05_sched.owner = NULL;
+		srf05_sched_next(ktime_get());
+	}
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+}
+
+/* called with data->lock held */
+static void srf05_engine_start(struct srf05_data *data)
+{
+	unsigned long flags;
+
+	if (data->engine_running || !data->users || !data->period ||
+			data->dead)
+		return;
+
+	write_seqlock_irq(&data->sample_lock);
+	data->sample_valid = false;
+	write_sequnlock_irq(&data->sample_lock);
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	data->engine_running = true;
+	data->next_due = ktime_get();
+	srf05_gov_reset(data);
+	srf05_sched_kick();
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+}
+
+/* called with data->lock held */
+static void srf05_engine_stop(struct srf05_data *data)
+{
+	unsigned long flags;
+
+	if (!data->engine_running)
+		return;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	data->engine_running = false;
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	/* readers waiting for a first sample must not wait for nothing */
+	wake_up_interruptible(&data->sample_wq);
+}
+
+/*
+ * returns the latest sample as distance or negative errno and optionally
+ * its timestamp
+ */
+static int srf05_latest(struct srf05_data *data, bool *valid, s64 *ts)
+{
+	struct srf05_record *rec;
+	unsigned int seq;
+	int distance;
+	s64 timestamp;
+
+	do {
+		seq = read_seqbegin(&data->sample_lock);
+		rec = &data->ring[(data->sample_seq - 1) & (SRF05_RING_SIZE - 1)];
+		distance = rec->status ? rec->status : rec->distance;
+		timestamp = rec->timestamp;
+		*valid = data->sample_valid;
+	} while (read_seqretry(&data->sample_lock, seq));
+
+	if (ts)
+		*ts = timestamp;
+
+	return distance;
+}
+
+/* copies the latest record, false while there is none */
+static bool srf05_latest_record(struct srf05_data *data,
+					struct srf05_record *out)
+{
+	unsigned int seq;
+	bool valid;
+
+	do {
+		seq = read_seqbegin(&data->sample_lock);
+		*out = data->ring[(data->sample_seq - 1) & (SRF05_RING_SIZE - 1)];
+		valid = data->sample_valid;
+	} while (read_seqretry(&data->sample_lock, seq));
+
+	return valid;
+}
+
+/* takes data->lock and accounts the wait for it */
+static void srf05_lock(struct srf05_data *data)
+{
+	ktime_t start = ktime_get();
+
+	mutex_lock(&data->lock);
+	srf05_hist_since(&data->hist_lock, start);
+}
+
+/* asks the scheduler for a single ping of data */
+static void srf05_request(struct srf05_data *data)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	data->oneshot = true;
+	srf05_sched_kick();
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+}
+
+/*
+ * waits until a sample after seq is published, at most timeout jiffies;
+ * without the engine running a ping is requested for every cycle that
+ * ended without a sample (e.g. dropped by the filter)
+ */
+static long srf05_wait_sample(struct srf05_data *data, u32 seq,
+							long timeout)
+{
+	u32 cycles;
+	long ret;
+
+	do {
+		cycles = READ_ONCE(data->cycle_seq);
+		if (!READ_ONCE(data->engine_running))
+			srf05_request(data);
+		ret = wait_event_interruptible_timeout(data->sample_wq,
+				READ_ONCE(data->sample_seq) != seq ||
+				READ_ONCE(data->cycle_seq) != cycles ||
+				READ_ONCE(data->dead), timeout);
+		if (READ_ONCE(data->dead))
+			return -ENODEV;
+		if (ret < 0)
+			atomic_long_inc(&data->killed_waits);
+		if (ret <= 0)
+			return ret;
+		timeout = ret;
+	} while (READ_ONCE(data->sample_seq) == seq);
+
+	return ret;
+}
+
+static int srf05_read_latest(struct srf05_data *data)
+{
+	int distance;
+	bool valid;
+	long ret;
+
+	/* right after the engine started there is no sample yet */
+	ret = wait_event_interruptible_timeout(data->sample_wq,
+			READ_ONCE(data->sample_valid) ||
+			!READ_ONCE(data->engine_running),
+			nsecs_to_jiffies(ktime_to_ns(srf05_engine_period(data))) +
+			HZ / 10);
+	if (ret < 0) {
+		atomic_long_inc(&data->killed_waits);
+		return ret;
+	}
+
+	distance = srf05_latest(data, &valid, NULL);
+	if (!valid)
+		return -EAGAIN;
+
+	return distance;
+}
+
+/*
+ * the sensor answers a trigger after a fixed time, so what varies in the
+ * latency to the rising edge is how late the edges get timestamped
+ */
+static void srf05_jitter_account(struct srf05_data *data, int latency)
+{
+	if (!data->lat_mean) {
+		data->lat_mean = latency;
+		return;
+	}
+
+	data->lat_mean += (latency - data->lat_mean) / 16;
+	data->lat_jitter += (abs(latency - data->lat_mean) -
+						data->lat_jitter) / 16;
+}
+
+/*
+ * called with srf05_sched.lock held for an edge of the echo line seen
+ * at ts (CLOCK_MONOTONIC); hw is the hardware timestamp of the edge, in
+ * the provider's clock, or 0 without one. level is -1 if the capture
+ * path does not know it. The echo line is low when the trigger is
+ * fired, so without a level the first edge of a cycle is the rising one
+ */
+static void srf05_echo_edge(struct srf05_data *data, ktime_t ts, u64 hw,
+								int level)
+{
+	bool rising = level >= 0 ? level : !data->echo_started;
+	s64 width;
+
+	/* edges of a sensor which has not been pinged are crosstalk */
+	if (srf05_sched.owner != data)
+		return;
+
+	if (rising) {
+		s64 latency = ktime_to_ns(ktime_sub(ts, data->ts_trigger));
+
+		data->ts_rising = ts;
+		data->hw_rising = hw;
+		data->echo_started = true;
+		srf05_hist_add(&data->hist_rising, latency);
+		srf05_jitter_account(data, clamp_t(s64, latency, 0, INT_MAX));
+	} else if (data->echo_started) {
+		/* both edges come with the same kind of timestamp */
+		width = hw ? (s64)(hw - data->hw_rising) :
+				ktime_to_ns(ktime_sub(ts, data->ts_rising));
+		srf05_hist_add(&data->hist_echo, width);
+		srf05_sched_complete(data, srf05_distance(data, width),
+					data->ts_rising, ktime_get());
+	}
+}
+
+static irqreturn_t srf05_handle_irq(int irq, void *dev_id)
+{
+	struct srf05_data *data = dev_id;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	srf05_echo_edge(data, now, 0, -1);
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return IRQ_HANDLED;
+}
+
+#if IS_ENABLED(CONFIG_HTE)
+static hte_return_t srf05_hte_ts(struct hte_ts_data *ts, void *dev_id)
+{
+	struct srf05_data *data = dev_id;
+	unsigned long flags;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	srf05_echo_edge(data, ktime_get(), ts->tsc, ts->raw_level);
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return HTE_CB_HANDLED;
+}
+
+/* like gpiolib-cdev: the provider is found from the echo GPIO itself */
+static int srf05_hte_init(struct srf05_data *data)
+{
+	int ret;
+
+	hte_init_line_attr(&data->hte_desc, desc_to_gpio(data->gpiod_echo),
+			HTE_RISING_EDGE_TS | HTE_FALLING_EDGE_TS, NULL,
+			data->gpiod_echo);
+
+	ret = hte_ts_get(NULL, &data->hte_desc, 0);
+	if (ret)
+		return ret;
+
+	/*
+	 * the provider enables timestamping of the line in its request
+	 * callback; puts the desc on release from here on
+	 */
+	ret = devm_hte_request_ts_ns(data->dev, &data->hte_desc,
+						srf05_hte_ts, NULL, data);
+	if (ret) {
+		hte_ts_put(&data->hte_desc);
+		return ret;
+	}
+
+	data->hte = true;
+
+	return 0;
+}
+#else
+static int srf05_hte_init(struct srf05_data *data)
+{
+	return -EOPNOTSUPP;
+}
+#endif
+
+static int srf05_read(struct srf05_data *data)
+{
+	ktime_t coalesce;
+	bool valid;
+	int distance;
+	long ret;
+	u32 sample_seq;
+	s64 ts;
+
+	/* the engine is ranging anyway, just hand out its latest result */
+	if (READ_ONCE(data->engine_running))
+		return srf05_read_latest(data);
+
+	/* a result fresh enough for the caller needs no ping */
+	coalesce = READ_ONCE(data->coalesce);
+	if (coalesce) {
+		distance = srf05_latest(data, &valid, &ts);
+		if (valid && ktime_get_ns() - ts <= ktime_to_ns(coalesce))
+			return distance;
+	}
+
+	/*
+	 * ask the scheduler for a ping and wait until a sample is
+	 * published. Concurrent readers all wait for the same one: the
+	 * request is a flag, so a reader arriving while the ping is in
+	 * flight just joins it.
+	 *
+	 * the scheduler completes every ping, at the latest by its
+	 * deadline; waiting longer only happens while other sensors
+	 * have their turn or the filter drops failed cycles
+	 */
+	sample_seq = READ_ONCE(data->sample_seq);
+	ret = srf05_wait_sample(data, sample_seq, HZ);
+	if (ret <= 0)
+		return ret ? ret : -ETIMEDOUT;
+
+	return srf05_latest(data, &valid, NULL);
+}
+
+static int srf05_read_raw(struct iio_dev *indio_dev,
+			    struct iio_chan_spec const *channel, int *val,
+			    int *val2, long info)
+{
+	struct srf05_data *data = iio_priv(indio_dev);
+	int ret;
+
+	if (channel->type != IIO_DISTANCE)
+		return -EINVAL;
+	switch (info) {
+	case IIO_CHAN_INFO_RAW:
+		/*
+		 * the scheduler would serialize the pings, but a single shot
+		 * still must not take samples the buffer is waiting for
+		 */
+		ret = iio_device_claim_direct_mode(indio_dev);
+		if (ret)
+			return ret;
+		ret = srf05_read(data);
+		iio_device_release_direct_mode(indio_dev);
+		if (ret < 0)
+			return ret;
+		*val = ret;
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		/*
+		 * theoretical maximum resolution is 3 mm
+		 * 1 LSB is 1 mm
+		 */
+		*val = 0;
+		*val2 = 1000;
+		return IIO_VAL_INT_PLUS_MICRO;
+	default:
+		return -EINVAL;
+	}
+}
+
+static struct srf05_thresh *srf05_thresh_get(struct srf05_data *data,
+					enum iio_event_type type,
+					enum iio_event_direction dir)
+{
+	if (type != IIO_EV_TYPE_THRESH)
+		return NULL;
+
+	switch (dir) {
+	case IIO_EV_DIR_RISING:
+		return &data->thresh_rising;
+	case IIO_EV_DIR_FALLING:
+		return &data->thresh_falling;
+	default:
+		return NULL;
+	}
+}
+
+static int srf05_read_event_config(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan,
+				enum iio_event_type type,
+				enum iio_event_direction dir)
+{
+	struct srf05_data *data = iio_priv(indio_dev);
+	struct srf05_thresh *thresh = srf05_thresh_get(data, type, dir);
+
+	if (!thresh)
+		return -EINVAL;
+
+	return READ_ONCE(thresh->enabled);
+}
+
+static int srf05_write_event_config(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan,
+				enum iio_event_type type,
+				enum iio_event_direction dir, int state)
+{
+	struct srf05_data *data = iio_priv(indio_dev);
+	struct srf05_thresh *thresh = srf05_thresh_get(data, type, dir);
+	unsigned long flags;
+	bool any;
+
+	if (!thresh)
+		return -EINVAL;
+
+	srf05_lock(data);
+
+	/* a newly enabled event fires on the first sample beyond it */
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	thresh->enabled = state;
+	thresh->armed = true;
+	any = data->thresh_rising.enabled || data->thresh_falling.enabled;
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	if (any && !data->event_user) {
+		data->event_user = true;
+		data->users++;
+		/* without a period nothing would ever be evaluated */
+		if (!data->period) {
+			spin_lock_irqsave(&srf05_sched.lock, flags);
+			data->period = ms_to_ktime(SRF05_EVENT_PERIOD_MS);
+			if (ktime_before(data->period, srf05_min_period(data)))
+				data->period = srf05_min_period(data);
+			spin_unlock_irqrestore(&srf05_sched.lock, flags);
+			data->event_period = true;
+		}
+		srf05_engine_start(data);
+	} else if (!any && data->event_user) {
+		data->event_user = false;
+		if (data->event_period) {
+			data->event_period = false;
+			spin_lock_irqsave(&srf05_sched.lock, flags);
+			data->period = 0;
+			spin_unlock_irqrestore(&srf05_sched.lock, flags);
+			srf05_engine_stop(data);
+		}
+		if (!--data->users)
+			srf05_engine_stop(data);
+	}
+
+	mutex_unlock(&data->lock);
+
+	return 0;
+}
+
+static int srf05_read_event_value(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan,
+				enum iio_event_type type,
+				enum iio_event_direction dir,
+				enum iio_event_info info,
+				int *val, int *val2)
+{
+	struct srf05_data *data = iio_priv(indio_dev);
+	struct srf05_thresh *thresh = srf05_thresh_get(data, type, dir);
+
+	if (!thresh)
+		return -EINVAL;
+
+	switch (info) {
+	case IIO_EV_INFO_VALUE:
+		*val = READ_ONCE(thresh->value);
+		return IIO_VAL_INT;
+	case IIO_EV_INFO_HYSTERESIS:
+		*val = READ_ONCE(thresh->hyst);
+		return IIO_VAL_INT;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int srf05_write_event_value(struct iio_dev *indio_dev,
+				const struct iio_chan_spec *chan,
+				enum iio_event_type type,
+				enum iio_event_direction dir,
+				enum iio_event_info info,
+				int val, int val2)
+{
+	struct srf05_data *data = iio_priv(indio_dev);
+	struct srf05_thresh *thresh = srf05_thresh_get(data, type, dir);
+	unsigned long flags;
+
+	if (!thresh)
+		return -EINVAL;
+
+	/* same unit as the raw value: mm */
+	if (val < 0 || val > SRF05_MAX_RANGE_MM || val2)
+		return -EINVAL;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	switch (info) {
+	case IIO_EV_INFO_VALUE:
+		thresh->value = val;
+		break;
+	case IIO_EV_INFO_HYSTERESIS:
+		thresh->hyst = val;
+		break;
+	default:
+		spin_unlock_irqrestore(&srf05_sched.lock, flags);
+		return -EINVAL;
+	}
+	/* judge the next sample against the new limits */
+	thresh->armed = true;
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return 0;
+}
+
+static ssize_t srf05_engine_period_us_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%lld\n", ktime_to_us(READ_ONCE(data->period)));
+}
+
+static ssize_t srf05_engine_period_us_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+	unsigned long flags;
+	unsigned int period_us;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &period_us);
+	if (ret)
+		return ret;
+
+	srf05_lock(data);
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	/* 0 switches the engine off */
+	if (period_us &&
+		ktime_before(us_to_ktime(period_us), srf05_min_period(data))) {
+		spin_unlock_irqrestore(&srf05_sched.lock, flags);
+		mutex_unlock(&data->lock);
+		return -EINVAL;
+	}
+	data->period = us_to_ktime(period_us);
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+	/* an explicit period, also 0, replaces the one of the events */
+	data->event_period = false;
+	if (period_us)
+		srf05_engine_start(data);
+	else
+		srf05_engine_stop(data);
+	mutex_unlock(&data->lock);
+
+	return len;
+}
+
+static IIO_DEVICE_ATTR(engine_period_us, 0644,
+			srf05_engine_period_us_show,
+			srf05_engine_period_us_store, 0);
+
+static ssize_t srf05_max_range_mm_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%u\n", READ_ONCE(data->max_range_mm));
+}
+
+static ssize_t srf05_max_range_mm_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+	unsigned long flags;
+	unsigned int range_mm;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &range_mm);
+	if (ret)
+		return ret;
+
+	if (range_mm < SRF05_MIN_RANGE_MM || range_mm > SRF05_MAX_RANGE_MM)
+		return -EINVAL;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	srf05_set_range(data, range_mm);
+	/* a running engine may not ping faster than the new range allows */
+	if (data->period && ktime_before(data->period, srf05_min_period(data)))
+		data->period = srf05_min_period(data);
+	srf05_gov_reset(data);
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return len;
+}
+
+static IIO_DEVICE_ATTR(max_range_mm, 0644,
+			srf05_max_range_mm_show,
+			srf05_max_range_mm_store, 0);
+
+enum srf05_gov_attr {
+	SRF05_GOV_MIN_HZ,
+	SRF05_GOV_MAX_HZ,
+	SRF05_GOV_SLOPE_LOW,
+	SRF05_GOV_SLOPE_HIGH,
+};
+
+static ssize_t srf05_governor_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+	unsigned int val;
+
+	switch (to_iio_dev_attr(attr)->address) {
+	case SRF05_GOV_MIN_HZ:
+		val = READ_ONCE(data->gov_min_hz);
+		break;
+	case SRF05_GOV_MAX_HZ:
+		val = READ_ONCE(data->gov_max_hz);
+		break;
+	case SRF05_GOV_SLOPE_LOW:
+		val = READ_ONCE(data->gov_slope_low);
+		break;
+	default:
+		val = READ_ONCE(data->gov_slope_high);
+		break;
+	}
+
+	return sprintf(buf, "%u\n", val);
+}
+
+static ssize_t srf05_governor_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+	unsigned int min_hz, max_hz, low, high;
+	unsigned long flags;
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	min_hz = data->gov_min_hz;
+	max_hz = data->gov_max_hz;
+	low = data->gov_slope_low;
+	high = data->gov_slope_high;
+
+	switch (to_iio_dev_attr(attr)->address) {
+	case SRF05_GOV_MIN_HZ:
+		min_hz = val;
+		break;
+	case SRF05_GOV_MAX_HZ:
+		max_hz = val;
+		break;
+	case SRF05_GOV_SLOPE_LOW:
+		low = val;
+		break;
+	default:
+		high = val;
+		break;
+	}
+
+	/* governor_max_hz 0 switches the governor off */
+	if (!min_hz || (max_hz && min_hz > max_hz) || low > high) {
+		spin_unlock_irqrestore(&srf05_sched.lock, flags);
+		return -EINVAL;
+	}
+
+	data->gov_min_hz = min_hz;
+	data->gov_max_hz = max_hz;
+	data->gov_slope_low = low;
+	data->gov_slope_high = high;
+	srf05_gov_reset(data);
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return len;
+}
+
+static IIO_DEVICE_ATTR(governor_min_hz, 0644,
+			srf05_governor_show,
+			srf05_governor_store, SRF05_GOV_MIN_HZ);
+static IIO_DEVICE_ATTR(governor_max_hz, 0644,
+			srf05_governor_show,
+			srf05_governor_store, SRF05_GOV_MAX_HZ);
+static IIO_DEVICE_ATTR(governor_slope_low, 0644,
+			srf05_governor_show,
+			srf05_governor_store, SRF05_GOV_SLOPE_LOW);
+static IIO_DEVICE_ATTR(governor_slope_high, 0644,
+			srf05_governor_show,
+			srf05_governor_store, SRF05_GOV_SLOPE_HIGH);
+
+static ssize_t srf05_governor_period_us_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%lld\n", ktime_to_us(srf05_engine_period(data)));
+}
+
+static IIO_DEVICE_ATTR(governor_period_us, 0444,
+			srf05_governor_period_us_show, NULL, 0);
+
+static ssize_t srf05_coalesce_us_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%lld\n", ktime_to_us(READ_ONCE(data->coalesce)));
+}
+
+static ssize_t srf05_coalesce_us_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+	unsigned int coalesce_us;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &coalesce_us);
+	if (ret)
+		return ret;
+
+	/* 0: only share pings in flight */
+	if (coalesce_us > USEC_PER_SEC)
+		return -EINVAL;
+
+	WRITE_ONCE(data->coalesce, us_to_ktime(coalesce_us));
+
+	return len;
+}
+
+static IIO_DEVICE_ATTR(coalesce_us, 0644,
+			srf05_coalesce_us_show,
+			srf05_coalesce_us_store, 0);
+
+static ssize_t srf05_ambient_temp_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%d\n", READ_ONCE(data->temp_mc));
+}
+
+static ssize_t srf05_ambient_temp_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+	unsigned long flags;
+	int temp_mc;
+	int ret;
+
+	ret = kstrtoint(buf, 10, &temp_mc);
+	if (ret)
+		return ret;
+
+	/* where the sensor works at all */
+	if (temp_mc < -40000 || temp_mc > 85000)
+		return -EINVAL;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	data->temp_mc = temp_mc;
+	data->speed_mmps = srf05_speed(temp_mc);
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return len;
+}
+
+static IIO_DEVICE_ATTR(ambient_temp, 0644,
+			srf05_ambient_temp_show,
+			srf05_ambient_temp_store, 0);
+
+static ssize_t srf05_filter_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%s\n", srf05_filter_names[READ_ONCE(data->filter)]);
+}
+
+static ssize_t srf05_filter_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+	unsigned long flags;
+	int ret;
+
+	ret = sysfs_match_string(srf05_filter_names, buf);
+	if (ret < 0)
+		return ret;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	data->filter = ret;
+	data->filter_count = 0;
+	data->filter_pos = 0;
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return len;
+}
+
+static IIO_DEVICE_ATTR(filter, 0644,
+			srf05_filter_show,
+			srf05_filter_store, 0);
+
+static ssize_t srf05_filter_window_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%u\n", READ_ONCE(data->filter_window));
+}
+
+static ssize_t srf05_filter_window_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t len)
+{
+	struct srf05_data *data = iio_priv(dev_to_iio_dev(dev));
+	unsigned long flags;
+	unsigned int window;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &window);
+	if (ret)
+		return ret;
+
+	if (!window || window > SRF05_FILTER_MAX_WINDOW)
+		return -EINVAL;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	data->filter_window = window;
+	data->filter_count = 0;
+	data->filter_pos = 0;
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return len;
+}
+
+static IIO_DEVICE_ATTR(filter_window, 0644,
+			srf05_filter_window_show,
+			srf05_filter_window_store, 0);
+
+static struct attribute *srf05_attributes[] = {
+	&iio_dev_attr_engine_period_us.dev_attr.attr,
+	&iio_dev_attr_governor_min_hz.dev_attr.attr,
+	&iio_dev_attr_governor_max_hz.dev_attr.attr,
+	&iio_dev_attr_governor_slope_low.dev_attr.attr,
+	&iio_dev_attr_governor_slope_high.dev_attr.attr,
+	&iio_dev_attr_governor_period_us.dev_attr.attr,
+	&iio_dev_attr_max_range_mm.dev_attr.attr,
+	&iio_dev_attr_coalesce_us.dev_attr.attr,
+	&iio_dev_attr_ambient_temp.dev_attr.attr,
+	&iio_dev_attr_filter.dev_attr.attr,
+	&iio_dev_attr_filter_window.dev_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group srf05_attribute_group = {
+	.attrs = srf05_attributes,
+};
+
+static const struct iio_info srf05_iio_info = {
+	.read_raw		= srf05_read_raw,
+	.read_event_config	= srf05_read_event_config,
+	.write_event_config	= srf05_write_event_config,
+	.read_event_value	= srf05_read_event_value,
+	.write_event_value	= srf05_write_event_value,
+	.attrs			= &srf05_attribute_group,
+};
+
+static const struct iio_event_spec srf05_events[] = {
+	{
+		.type = IIO_EV_TYPE_THRESH,
+		.dir = IIO_EV_DIR_RISING,
+		.mask_separate = BIT(IIO_EV_INFO_VALUE) |
+				BIT(IIO_EV_INFO_HYSTERESIS) |
+				BIT(IIO_EV_INFO_ENABLE),
+	}, {
+		.type = IIO_EV_TYPE_THRESH,
+		.dir = IIO_EV_DIR_FALLING,
+		.mask_separate = BIT(IIO_EV_INFO_VALUE) |
+				BIT(IIO_EV_INFO_HYSTERESIS) |
+				BIT(IIO_EV_INFO_ENABLE),
+	},
+};
+
+static const struct iio_chan_spec srf05_chan_spec[] = {
+	{
+		.type = IIO_DISTANCE,
+		.info_mask_separate =
+				BIT(IIO_CHAN_INFO_RAW) |
+				BIT(IIO_CHAN_INFO_SCALE),
+		.event_spec = srf05_events,
+		.num_event_specs = ARRAY_SIZE(srf05_events),
+		.scan_index = 0,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 16,
+			.storagebits = 16,
+			.endianness = IIO_CPU,
+		},
+	},
+	IIO_CHAN_SOFT_TIMESTAMP(1),
+};
+
+static irqreturn_t srf05_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct srf05_data *data = iio_priv(indio_dev);
+	struct srf05_record rec;
+	s64 age;
+
+	/*
+	 * one ranging cycle per trigger; failed cycles (timeout, echo out
+	 * of range) are just not pushed into the buffer. With the engine
+	 * running srf05_read() hands out its latest sample, which is only
+	 * pushed once and stamped with the time it was measured, not with
+	 * the time of the trigger
+	 */
+	if (srf05_read(data) >= 0 && srf05_latest_record(data, &rec) &&
+	    !rec.status && rec.seq + 1 != data->scan_next) {
+		data->scan_next = rec.seq + 1;
+		/* the record is CLOCK_MONOTONIC, the buffer the IIO clock */
+		age = ktime_get_ns() - rec.timestamp;
+		data->scan.distance = rec.distance;
+		iio_push_to_buffers_with_timestamp(indio_dev, &data->scan,
+					iio_get_time_ns(indio_dev) - age);
+	}
+
+	iio_trigger_notify_done(indio_dev->trig);
+
+	return IRQ_HANDLED;
+}
+
+static int srf05_open(struct inode *inode, struct file *file)
+{
+	struct srf05_data *data = container_of(inode->i_cdev,
+						struct srf05_data, cdev);
+	struct srf05_file *f;
+
+    printk("SRF05: Device open\n");
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	/* a new reader only gets the samples from now on */
+	f->data = data;
+	mutex_init(&f->lock);
+	f->next_seq = READ_ONCE(data->sample_seq);
+	file->private_data = f;
+
+	srf05_lock(data);
+	/* raced with the unbind */
+	if (data->dead) {
+		mutex_unlock(&data->lock);
+		kfree(f);
+		return -ENODEV;
+	}
+	data->users++;
+	srf05_engine_start(data);
+	mutex_unlock(&data->lock);
+
+    return 0;
+}
+
+static int srf05_release(struct inode *inode, struct file *file)
+{
+	struct srf05_file *f = file->private_data;
+	struct srf05_data *data = f->data;
+	unsigned long flags;
+
+    printk("SRF05: Device close\n");
+
+	/* an unanswered request must not keep pinging for nobody */
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	if (f->async_pending && data->sample_seq == f->async_seq &&
+			data->async_waiters)
+		data->async_waiters--;
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	srf05_lock(data);
+	if (!--data->users)
+		srf05_engine_stop(data);
+	/* the last file of a removed sensor takes the ring along */
+	if (!data->users && data->dead)
+		vfree(data->ring_hdr);
+	mutex_unlock(&data->lock);
+
+	kfree(f);
+
+    return 0;
+}
+
+/*
+ * copies up to max records pending for f to buf; sleeps until at least
+ * one is there unless nonblock is set
+ */
+static ssize_t srf05_fetch(struct srf05_file *f,
+			struct srf05_record __user *buf, size_t max,
+			bool nonblock)
+{
+	struct srf05_data *data = f->data;
+	struct srf05_record rec[SRF05_FETCH_CHUNK];
+	unsigned int seq;
+	ssize_t done = 0;
+	size_t n, i;
+	u32 next, head;
+	long ret;
+
+	if (!max)
+		return 0;
+
+	mutex_lock(&f->lock);
+
+	while (READ_ONCE(data->sample_seq) == f->next_seq) {
+		if (nonblock) {
+			done = -EAGAIN;
+			goto out;
+		}
+		ret = srf05_wait_sample(data, f->next_seq, HZ);
+		if (ret < 0) {
+			done = ret;
+			goto out;
+		}
+	}
+
+	while ((size_t)done < max) {
+		do {
+			seq = read_seqbegin(&data->sample_lock);
+			head = data->sample_seq;
+			next = f->next_seq;
+			/* the reader fell behind, skip what was overwritten */
+			if (head - next > SRF05_RING_SIZE)
+				next = head - SRF05_RING_SIZE;
+			n = min_t(size_t, head - next, max - done);
+			n = min_t(size_t, n, SRF05_FETCH_CHUNK);
+			for (i = 0; i < n; i++)
+				rec[i] = data->ring[(next + i) &
+						(SRF05_RING_SIZE - 1)];
+		} while (read_seqretry(&data->sample_lock, seq));
 
-#define IOCTL_APP_TYPE 71
-#define READ_VALUE _IOR(IOCTL_APP_TYPE,2,int32_t*)
+		if (!n)
+			break;
 
-#define MAX_DEV 1
-#define FIRST_MINOR 0
+		if (copy_to_user(buf + done, rec, n * sizeof(*rec))) {
+			if (!done)
+				done = -EFAULT;
+			break;
+		}
+		f->next_seq = next + n;
+		done += n;
+	}
 
-dev_t dev_num_t;
-static struct cdev cdev;
-static struct class *srf05_class;
+out:
+	mutex_unlock(&f->lock);
 
-struct srf05_data {
-	struct device		*dev;
-	struct gpio_desc	*gpiod_trig;
-	struct gpio_desc	*gpiod_echo;
-	struct mutex		lock;
-	int			irqnr;
-	ktime_t			ts_rising;
-	ktime_t			ts_falling;
-	struct completion	rising;
-	struct completion	falling;
-};
+	return done;
+}
 
-int32_t value = 0;
-int rets = 0;
-int rer;
-int p_val;
-int val2;
+static ssize_t srf05_fread(struct file *file, char __user *buf, size_t len,
+								loff_t *off)
+{
+	struct srf05_file *f = file->private_data;
+	ssize_t ret;
 
-struct iio_dev *indio_dev;
-struct iio_chan_spec const *channel;
+	if (READ_ONCE(f->data->dead))
+		return -ENODEV;
 
-static int srf05_open(struct inode *inode, struct file *file);
-static int srf05_release(struct inode *inode, struct file *file);
-static long srf05_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+	/* only whole records */
+	if (len < sizeof(struct srf05_record))
+		return -EINVAL;
 
-static struct file_operations fops = {
-	.owner = THIS_MODULE,
-	.open       = srf05_open,
-    .release    = srf05_release,
-    .unlocked_ioctl = srf05_ioctl,
-};
+	ret = srf05_fetch(f, (struct srf05_record __user *)buf,
+			len / sizeof(struct srf05_record),
+			file->f_flags & O_NONBLOCK);
+	if (ret < 0)
+		return ret;
 
-static irqreturn_t srf05_handle_irq(int irq, void *dev_id)
+	return ret * sizeof(struct srf05_record);
+}
+
+static unsigned int srf05_poll(struct file *file, poll_table *wait)
 {
-	struct iio_dev *indio_dev = dev_id;
-	struct srf05_data *data = iio_priv(indio_dev);
-	ktime_t now = ktime_get();
+	struct srf05_file *f = file->private_data;
+	struct srf05_data *data = f->data;
 
-	if (gpiod_get_value(data->gpiod_echo)) {
-		data->ts_rising = now;
-		complete(&data->rising);
-	} else {
-		data->ts_falling = now;
-		complete(&data->falling);
+	poll_wait(file, &data->sample_wq, wait);
+
+	if (READ_ONCE(data->dead))
+		return POLLERR | POLLHUP;
+
+	/* the consumer of the mapping tells its position in the header */
+	if (READ_ONCE(f->mapped)) {
+		if (READ_ONCE(data->ring_hdr->head) !=
+					READ_ONCE(data->ring_hdr->tail))
+			return POLLIN | POLLRDNORM;
+		return 0;
 	}
 
-	return IRQ_HANDLED;
+	if (READ_ONCE(data->sample_seq) != READ_ONCE(f->next_seq))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
 }
 
-static int srf05_read(struct srf05_data *data)
+static int srf05_mmap(struct file *file, struct vm_area_struct *vma)
 {
+	struct srf05_file *f = file->private_data;
+	struct srf05_data *data = f->data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
 	int ret;
-	ktime_t ktime_dt;
-	u64 dt_ns;
-	u32 time_ns, distance_mm;
 
-	/*
-	 * just one read-echo-cycle can take place at a time
-	 * ==> lock against concurrent reading calls
-	 */
-	mutex_lock(&data->lock);
+	if (READ_ONCE(data->dead))
+		return -ENODEV;
 
-	reinit_completion(&data->rising);
-	reinit_completion(&data->falling);
+	if (off >= SRF05_RING_BYTES || size > SRF05_RING_BYTES - off)
+		return -EINVAL;
 
-	gpiod_set_value(data->gpiod_trig, 1);
-	udelay(10);
-	gpiod_set_value(data->gpiod_trig, 0);
+	/* the records belong to the driver, only the tail is written */
+	if (off + size > PAGE_SIZE) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
 
-	/* it cannot take more than 30 ms */
-	ret = wait_for_completion_killable_timeout(&data->rising, HZ/33.35);
-	if (ret < 0) {
-		mutex_unlock(&data->lock);
+	ret = remap_vmalloc_range(vma, data->ring_hdr, vma->vm_pgoff);
+	if (ret)
 		return ret;
-	} else if (ret == 0) {
-		mutex_unlock(&data->lock);
-		return -ETIMEDOUT;
+
+	WRITE_ONCE(f->mapped, true);
+
+	return 0;
+}
+
+/* asks for a ping without waiting for it */
+static int srf05_start_measurement(struct srf05_file *f)
+{
+	struct srf05_data *data = f->data;
+	unsigned long flags;
+
+	mutex_lock(&f->lock);
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+
+	/* from now on POLLIN means the result is there */
+	f->next_seq = data->sample_seq;
+	f->async_seq = data->sample_seq;
+	f->async_pending = true;
+
+	/* a running engine delivers the next sample anyway */
+	data->async_waiters++;
+	if (!data->engine_running) {
+		data->oneshot = true;
+		srf05_sched_kick();
 	}
 
-	ret = wait_for_completion_killable_timeout(&data->falling, HZ/33.35);
-	if (ret < 0) {
-		mutex_unlock(&data->lock);
-		return ret;
-	} else if (ret == 0) {
-		mutex_unlock(&data->lock);
-		return -ETIMEDOUT;
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+	mutex_unlock(&f->lock);
+
+	return 0;
+}
+
+/* hands out the first sample published after START_MEASUREMENT */
+static int srf05_get_result(struct srf05_file *f,
+			struct srf05_record __user *buf, bool nonblock)
+{
+	struct srf05_data *data = f->data;
+	struct srf05_record rec;
+	unsigned int seq;
+	u32 head, want;
+	long ret;
+
+	mutex_lock(&f->lock);
+
+	if (!f->async_pending) {
+		ret = -EINVAL;
+		goto out;
 	}
 
-	ktime_dt = ktime_sub(data->ts_falling, data->ts_rising);
+	while (READ_ONCE(data->sample_seq) == f->async_seq) {
+		if (nonblock) {
+			ret = -EAGAIN;
+			goto out;
+		}
+		ret = srf05_wait_sample(data, f->async_seq, HZ);
+		if (ret < 0)
+			goto out;
+	}
 
-	mutex_unlock(&data->lock);
+	do {
+		seq = read_seqbegin(&data->sample_lock);
+		head = data->sample_seq;
+		want = f->async_seq;
+		/* fetched that late, the oldest sample left has to do */
+		if (head - want > SRF05_RING_SIZE)
+			want = head - SRF05_RING_SIZE;
+		rec = data->ring[want & (SRF05_RING_SIZE - 1)];
+	} while (read_seqretry(&data->sample_lock, seq));
 
-	dt_ns = ktime_to_ns(ktime_dt);
-	/*
-	 * measuring more than 4 meters is beyond the capabilities of
-	 * the sensor
-	 * ==> filter out invalid results for not measuring echos of
-	 *     another us sensor
-	 *
-	 * formula:
-	 *         distance       4 m
-	 * time = ---------- = --------- = 12539185 ns
-	 *          speed       319 m/s
-	 *
-	 * using a minimum speed at -20 °C of 319 m/s
-	 */
-	if (dt_ns > 12539185)
-		return -EIO;
+	ret = 0;
+	if (copy_to_user(buf, &rec, sizeof(rec))) {
+		ret = -EFAULT;
+		goto out;
+	}
 
-	time_ns = dt_ns;
+	/* consumed: poll() stays quiet until the next start */
+	f->next_seq = head;
+	f->async_pending = false;
 
-	/*
-	 * the speed as function of the temperature is approximately:
-	 *
-	 * speed = 331,5 + 0,6 * Temp
-	 *   with Temp in °C
-	 *   and speed in m/s
-	 *
-	 * use 343 m/s as ultrasonic speed at 27 °C here in absence of the
-	 * temperature
-	 *
-	 * therefore:
-	 *             time     347
-	 * distance = ------ * -----
-	 *             10^6       2
-	 *   with time in ns
-	 *   and distance in mm (one way)
-	 *
-	 * because we limit to 4 meters the multiplication with 347 just
-	 * fits into 32 bit
-	 */
-	distance_mm = time_ns * 347 / 2000000;
+out:
+	mutex_unlock(&f->lock);
 
-	return distance_mm;
+	return ret;
 }
 
-static int srf05_read_raw(struct iio_dev *indio_dev,
-			    struct iio_chan_spec const *channel, int *val,
-			    int *val2, long info)
+static long srf05_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-	struct srf05_data *data = iio_priv(indio_dev);
-	int ret;
+	struct srf05_file *f = file->private_data;
+	struct srf05_data *data = f->data;
+	struct srf05_batch batch;
+	ktime_t start = ktime_get();
+	int32_t value;
+	ssize_t ret;
 
-	if (channel->type != IIO_DISTANCE)
-		return -EINVAL;
-	switch (info) {
-	case IIO_CHAN_INFO_RAW:
-		val2 = NULL;
-		val = NULL;
-		ret = srf05_read(data);
-		if (ret < 0) 
-			return -1;
-		else
-			return ret;
-	case IIO_CHAN_INFO_SCALE:
-		/*
-		 * theoretical maximum resolution is 3 mm
-		 * 1 LSB is 1 mm
-		 */
-		*val = 0;
-		*val2 = 1000;
-		return IIO_VAL_INT_PLUS_MICRO;
+	if (READ_ONCE(data->dead))
+		return -ENODEV;
+
+	switch (cmd) {
+	case READ_VALUE:
+		value = srf05_read(data);
+		ret = value;
+		if (copy_to_user((int32_t __user *)arg, &value, sizeof(value)))
+			ret = -EFAULT;
+		break;
+	case START_MEASUREMENT:
+		ret = srf05_start_measurement(f);
+		break;
+	case GET_RESULT:
+		ret = srf05_get_result(f, (struct srf05_record __user *)arg,
+						file->f_flags & O_NONBLOCK);
+		break;
+	case READ_BATCH:
+		if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+			return -EFAULT;
+		ret = srf05_fetch(f, u64_to_user_ptr(batch.records),
+				batch.count, file->f_flags & O_NONBLOCK);
+		if (ret < 0)
+			break;
+		batch.count = ret;
+		ret = 0;
+		if (copy_to_user((void __user *)arg, &batch, sizeof(batch)))
+			ret = -EFAULT;
+		break;
 	default:
-		return -EINVAL;
+		return -ENOTTY;
 	}
+
+	srf05_hist_since(&data->hist_ioctl, start);
+
+	return ret;
 }
 
-static const struct iio_info srf05_iio_info = {
-	.read_raw		= srf05_read_raw,
-};
+static int srf05_hist_show(struct seq_file *s, void *unused)
+{
+	static const unsigned int permille[] = { 500, 900, 990, 999 };
+	static const char * const names[] = { "p50", "p90", "p99", "p99.9" };
+	struct srf05_hist *hist = s->private;
+	unsigned long count[SRF05_HIST_BUCKETS];
+	unsigned long total = 0, sum;
+	unsigned int i, p;
 
-static const struct iio_chan_spec srf05_chan_spec[] = {
-	{
-		.type = IIO_DISTANCE,
-		.info_mask_separate =
-				BIT(IIO_CHAN_INFO_RAW) |
-				BIT(IIO_CHAN_INFO_SCALE),
-	},
-};
+	for (i = 0; i < SRF05_HIST_BUCKETS; i++) {
+		count[i] = atomic_long_read(&hist->bucket[i]);
+		total += count[i];
+	}
 
-static int srf05_open(struct inode *inode, struct file *file)
+	seq_printf(s, "samples %lu\n", total);
+	if (!total)
+		return 0;
+
+	/* percentiles are upper bounds of the bucket they fall into */
+	for (p = 0; p < ARRAY_SIZE(permille); p++) {
+		sum = 0;
+		for (i = 0; i < SRF05_HIST_BUCKETS - 1; i++) {
+			sum += count[i];
+			if ((u64)sum * 1000 >= (u64)total * permille[p])
+				break;
+		}
+		seq_printf(s, "%-5s < %llu ns\n", names[p], 1ULL << i);
+	}
+
+	seq_puts(s, "\n     from ns        to ns      count\n");
+	for (i = 0; i < SRF05_HIST_BUCKETS; i++) {
+		if (!count[i])
+			continue;
+		seq_printf(s, "%12llu %12llu %10lu\n",
+				i ? 1ULL << (i - 1) : 0, 1ULL << i, count[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(srf05_hist);
+
+static int srf05_counters_show(struct seq_file *s, void *unused)
 {
-    printk("SRF05: Device open\n");
-    return 0;
+	struct srf05_data *data = s->private;
+
+	seq_printf(s, "timeouts %lu\n", atomic_long_read(&data->timeouts));
+	seq_printf(s, "range_errors %lu\n",
+				atomic_long_read(&data->range_errors));
+	seq_printf(s, "killed_waits %lu\n",
+				atomic_long_read(&data->killed_waits));
+
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(srf05_counters);
 
-static int srf05_release(struct inode *inode, struct file *file)
+static int srf05_capture_show(struct seq_file *s, void *unused)
 {
-    printk("SRF05: Device close\n");
-    return 0;
+	struct srf05_data *data = s->private;
+	unsigned long flags;
+	int mean, jitter;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	mean = data->lat_mean;
+	jitter = data->lat_jitter;
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	seq_printf(s, "mode %s\n", data->hte ? "hte" : "irq");
+	seq_printf(s, "latency_ns %d\n", mean);
+	seq_printf(s, "jitter_ns %d\n", jitter);
+
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(srf05_capture);
 
-static long srf05_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+static void srf05_debugfs_init(struct srf05_data *data)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(dev_name(data->chrdev), srf05_debugfs);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	debugfs_create_file("trigger_to_rising", 0444, dir,
+				&data->hist_rising, &srf05_hist_fops);
+	debugfs_create_file("echo_width", 0444, dir,
+				&data->hist_echo, &srf05_hist_fops);
+	debugfs_create_file("lock_wait", 0444, dir,
+				&data->hist_lock, &srf05_hist_fops);
+	debugfs_create_file("ioctl_latency", 0444, dir,
+				&data->hist_ioctl, &srf05_hist_fops);
+	debugfs_create_file("counters", 0444, dir,
+				data, &srf05_counters_fops);
+	debugfs_create_file("capture", 0444, dir,
+				data, &srf05_capture_fops);
+
+	data->debugfs = dir;
+}
+
+static ssize_t srf05_rate_show(struct srf05_rate *rate, char *buf)
+{
+	unsigned long flags;
+	u64 count;
+	u32 millihz;
+
+	spin_lock_irqsave(&srf05_sched.lock, flags);
+	count = rate->count;
+	millihz = srf05_rate_get(rate, ktime_get());
+	spin_unlock_irqrestore(&srf05_sched.lock, flags);
+
+	return sprintf(buf, "%u.%03u %llu\n", millihz / 1000, millihz % 1000,
+								count);
+}
+
+/* /sys/class/srf05/<dev>/sample_rate: samples/s and total samples */
+static ssize_t sample_rate_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct srf05_data *data = dev_get_drvdata(dev);
+
+	return srf05_rate_show(&data->rate, buf);
+}
+static DEVICE_ATTR_RO(sample_rate);
+
+static struct attribute *srf05_chrdev_attrs[] = {
+	&dev_attr_sample_rate.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(srf05_chrdev);
+
+/* /sys/class/srf05/sample_rate: the same summed up over all sensors */
+static ssize_t sample_rate_class_show(struct class *class,
+				struct class_attribute *attr, char *buf)
 {
-    // printk("SRF05: Device ioctl\n");
-	rets = srf05_read_raw(indio_dev,srf05_chan_spec,&p_val,&val2,IIO_CHAN_INFO_RAW);
-	rer = copy_to_user((int32_t*) arg, &rets, sizeof(rets));
-    return rets;
+	return srf05_rate_show(&srf05_sched.rate, buf);
 }
+static struct class_attribute class_attr_sample_rate =
+	__ATTR(sample_rate, 0444, sample_rate_class_show, NULL);
 
 static int srf05_uevent(struct device *dev, struct kobj_uevent_env *env)
 {
@@ -280,11 +2259,34 @@ static int srf05_uevent(struct device *dev, struct kobj_uevent_env *env)
     return 0;
 }
 
+/*
+ * runs once the IIO device is gone; files may outlive the sensor, they
+ * only get -ENODEV from now on and the last of them frees the ring
+ */
+static void srf05_ring_free(void *arg)
+{
+	struct srf05_data *data = arg;
+
+	mutex_lock(&data->lock);
+	WRITE_ONCE(data->dead, true);
+	if (data->event_user) {
+		data->event_user = false;
+		data->users--;
+	}
+	srf05_engine_stop(data);
+	if (!data->users)
+		vfree(data->ring_hdr);
+	mutex_unlock(&data->lock);
+
+	wake_up_interruptible(&data->sample_wq);
+}
+
 static int srf05_probe(struct platform_device *pdev)
 {
 	struct device *dev = &pdev->dev;
+	struct iio_dev *indio_dev;
 	struct srf05_data *data;
-	// struct iio_dev *indio_dev;
+	dev_t devt;
 	int ret;
 
 	indio_dev = devm_iio_device_alloc(dev, sizeof(struct srf05_data));
@@ -295,44 +2297,32 @@ static int srf05_probe(struct platform_device *pdev)
 
 	data = iio_priv(indio_dev);
 	data->dev = dev;
+	data->indio_dev = indio_dev;
 
-	/*Allocating Major number*/
-	ret = alloc_chrdev_region(&dev_num_t, FIRST_MINOR, MAX_DEV, "srf05");
-	if (ret){
-        dev_err(dev, "Can't register driver, error code: %d \n", ret); 
-        return -1;
-    } else printk(KERN_INFO "SRF05: Major = %d Minor = %d \n", MAJOR(dev_num_t), MINOR(dev_num_t));
-
-	/*Creating cdev structure*/
-	cdev_init(&cdev, &fops);
-	cdev.owner = THIS_MODULE;
-
-	/*Adding character device to the system*/
-	ret = cdev_add(&cdev, dev_num_t, 1);
-	if(ret)
-	{
-		printk(KERN_INFO "Cannot add the device to the system\n");
-		goto r_class;
-	}
-	
-	/*Creating struct class*/
-	if((srf05_class = class_create(THIS_MODULE,"srf05")) == NULL)
-	{
-		printk(KERN_INFO "Cannot create the struct class\n");
-		goto r_class;
-	}
-	srf05_class->dev_uevent = srf05_uevent;
-
-	/*Creating device*/
-	if((device_create(srf05_class,NULL,dev_num_t,NULL,"srf05")) == NULL){
-		printk(KERN_INFO "Cannot create the Device srf05\n");
-		goto r_device;
-	} else printk(KERN_INFO "SRF05: Device Driver Insert...Done!!!\n");
+	mutex_init(&data->lock);
+	seqlock_init(&data->sample_lock);
+	init_waitqueue_head(&data->sample_wq);
+	INIT_LIST_HEAD(&data->node);
 
+	srf05_set_range(data, 2000);
+	data->temp_mc = 26000;
+	data->speed_mmps = srf05_speed(data->temp_mc);
+	data->filter = SRF05_FILTER_NONE;
+	data->filter_window = 5;
+	data->gov_min_hz = 2;
+	data->gov_slope_low = 50;
+	data->gov_slope_high = 200;
 
-	mutex_init(&data->lock);
-	init_completion(&data->rising);
-	init_completion(&data->falling);
+	data->ring_hdr = vmalloc_user(SRF05_RING_BYTES);
+	if (!data->ring_hdr)
+		return -ENOMEM;
+	ret = devm_add_action_or_reset(dev, srf05_ring_free, data);
+	if (ret)
+		return ret;
+	data->ring_hdr->size = SRF05_RING_SIZE;
+	data->ring_hdr->record_size = sizeof(struct srf05_record);
+	data->ring_hdr->records_offset = PAGE_SIZE;
+	data->ring = (void *)data->ring_hdr + PAGE_SIZE;
 
 	data->gpiod_trig = devm_gpiod_get(dev, "trig", GPIOD_OUT_LOW);
 	if (IS_ERR(data->gpiod_trig)) {
@@ -348,23 +2338,34 @@ static int srf05_probe(struct platform_device *pdev)
 		return PTR_ERR(data->gpiod_echo);
 	}
 
-	if (gpiod_cansleep(data->gpiod_echo)) {
+	/* the trigger is pulsed from hrtimer and interrupt context */
+	if (gpiod_cansleep(data->gpiod_echo) ||
+				gpiod_cansleep(data->gpiod_trig)) {
 		dev_err(data->dev, "cansleep-GPIOs not supported\n");
 		return -ENODEV;
 	}
 
-	data->irqnr = gpiod_to_irq(data->gpiod_echo);
-	if (data->irqnr < 0) {
-		dev_err(data->dev, "gpiod_to_irq: %d\n", data->irqnr);
-		return data->irqnr;
-	}
-
-	ret = devm_request_irq(dev, data->irqnr, srf05_handle_irq,
-			IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
-			pdev->name, indio_dev);
-	if (ret < 0) {
-		dev_err(data->dev, "request_irq: %d\n", ret);
+	/* hardware timestamps if there are any, else interrupt time */
+	ret = srf05_hte_init(data);
+	if (ret == -EPROBE_DEFER || ret == -ENOMEM)
 		return ret;
+	if (ret)
+		dev_dbg(dev, "no hardware timestamps (%d)\n", ret);
+
+	if (!data->hte) {
+		data->irqnr = gpiod_to_irq(data->gpiod_echo);
+		if (data->irqnr < 0) {
+			dev_err(data->dev, "gpiod_to_irq: %d\n", data->irqnr);
+			return data->irqnr;
+		}
+
+		ret = devm_request_irq(dev, data->irqnr, srf05_handle_irq,
+				IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+				pdev->name, data);
+		if (ret < 0) {
+			dev_err(data->dev, "request_irq: %d\n", ret);
+			return ret;
+		}
 	}
 
 	platform_set_drvdata(pdev, indio_dev);
@@ -376,26 +2377,84 @@ static int srf05_probe(struct platform_device *pdev)
 	indio_dev->channels = srf05_chan_spec;
 	indio_dev->num_channels = ARRAY_SIZE(srf05_chan_spec);
 
-	return devm_iio_device_register(dev, indio_dev);
+	ret = devm_iio_triggered_buffer_setup(dev, indio_dev,
+			iio_pollfunc_store_time, srf05_trigger_handler, NULL);
+	if (ret < 0) {
+		dev_err(data->dev, "iio triggered buffer setup: %d\n", ret);
+		return ret;
+	}
+
+	/* one char device per sensor: srf05, srf05-1, srf05-2, ... */
+	data->id = ida_simple_get(&srf05_ida, 0, MAX_DEV, GFP_KERNEL);
+	if (data->id < 0) {
+		dev_err(dev, "too many srf05 devices: %d\n", data->id);
+		return data->id;
+	}
+	devt = MKDEV(MAJOR(dev_num_t), MINOR(dev_num_t) + data->id);
+
+	cdev_init(&data->cdev, &fops);
+	data->cdev.owner = THIS_MODULE;
+	/* keeps data around while a file is still open after remove */
+	data->cdev.kobj.parent = &indio_dev->dev.kobj;
+
+	/*Adding character device to the system*/
+	ret = cdev_add(&data->cdev, devt, 1);
+	if (ret) {
+		dev_err(dev, "Cannot add the device to the system\n");
+		goto r_ida;
+	}
+
+	/*Creating device*/
+	if (data->id)
+		data->chrdev = device_create_with_groups(srf05_class, dev,
+				devt, data, srf05_chrdev_groups,
+				"srf05-%d", data->id);
+	else
+		data->chrdev = device_create_with_groups(srf05_class, dev,
+				devt, data, srf05_chrdev_groups, "srf05");
+	if (IS_ERR(data->chrdev)) {
+		ret = PTR_ERR(data->chrdev);
+		dev_err(dev, "Cannot create the Device srf05: %d\n", ret);
+		goto r_cdev;
+	}
+
+	srf05_sched_add(data);
+	srf05_debugfs_init(data);
+
+	ret = devm_iio_device_register(dev, indio_dev);
+	if (ret < 0)
+		goto r_device;
+
+	dev_info(dev, "SRF05: %s ready\n", dev_name(data->chrdev));
+
+	return 0;
 
 r_device:
-        class_destroy(srf05_class);
-r_class:
-        unregister_chrdev_region(dev_num_t,1);
-        return -1;
+	debugfs_remove_recursive(data->debugfs);
+	srf05_sched_del(data);
+	device_destroy(srf05_class, devt);
+r_cdev:
+	cdev_del(&data->cdev);
+r_ida:
+	ida_simple_remove(&srf05_ida, data->id);
+	return ret;
 }
 
 static int srf05_remove(struct platform_device *pdev)
 {
-	struct srf05_data *data = platform_get_drvdata(pdev);
-	gpiod_put(data->gpiod_echo);
-	gpiod_put(data->gpiod_trig);
-    device_destroy(srf05_class, dev_num_t);
-    class_unregister(srf05_class);
-    class_destroy(srf05_class);
-	cdev_del(&cdev);
-	kfree(data);
-    unregister_chrdev_region(dev_num_t, MINORMASK);
+	struct iio_dev *indio_dev = platform_get_drvdata(pdev);
+	struct srf05_data *data = iio_priv(indio_dev);
+
+	mutex_lock(&data->lock);
+	srf05_engine_stop(data);
+	mutex_unlock(&data->lock);
+
+	srf05_sched_del(data);
+	debugfs_remove_recursive(data->debugfs);
+
+	device_destroy(srf05_class, data->cdev.dev);
+	cdev_del(&data->cdev);
+	ida_simple_remove(&srf05_ida, data->id);
 
 	return 0;
 }
@@ -416,7 +2475,68 @@ static struct platform_driver srf05_driver = {
 	},
 };
 
-module_platform_driver(srf05_driver);
+static int __init srf05_init(void)
+{
+	int ret;
+
+	spin_lock_init(&srf05_sched.lock);
+	INIT_LIST_HEAD(&srf05_sched.sensors);
+	hrtimer_init(&srf05_sched.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	srf05_sched.timer.function = srf05_sched_tick;
+
+	/*Allocating Major number*/
+	ret = alloc_chrdev_region(&dev_num_t, FIRST_MINOR, MAX_DEV, "srf05");
+	if (ret) {
+		pr_err("SRF05: Can't register driver, error code: %d\n", ret);
+		return ret;
+	}
+	pr_info("SRF05: Major = %d Minor = %d\n", MAJOR(dev_num_t),
+							MINOR(dev_num_t));
+
+	/*Creating struct class*/
+	srf05_class = class_create(THIS_MODULE, "srf05");
+	if (IS_ERR(srf05_class)) {
+		pr_err("SRF05: Cannot create the struct class\n");
+		ret = PTR_ERR(srf05_class);
+		goto r_region;
+	}
+	srf05_class->dev_uevent = srf05_uevent;
+
+	ret = class_create_file(srf05_class, &class_attr_sample_rate);
+	if (ret)
+		goto r_class;
+
+	srf05_debugfs = debugfs_create_dir("srf05", NULL);
+
+	ret = platform_driver_register(&srf05_driver);
+	if (ret)
+		goto r_debugfs;
+
+	return 0;
+
+r_debugfs:
+	debugfs_remove_recursive(srf05_debugfs);
+	class_remove_file(srf05_class, &class_attr_sample_rate);
+r_class:
+	class_destroy(srf05_class);
+r_region:
+	unregister_chrdev_region(dev_num_t, MAX_DEV);
+	return ret;
+}
+
+static void __exit srf05_exit(void)
+{
+	platform_driver_unregister(&srf05_driver);
+	hrtimer_cancel(&srf05_sched.timer);
+	debugfs_remove_recursive(srf05_debugfs);
+	class_remove_file(srf05_class, &class_attr_sample_rate);
+	class_destroy(srf05_class);
+	unregister_chrdev_region(dev_num_t, MAX_DEV);
+	ida_destroy(&srf05_ida);
+}
+
+module_init(srf05_init);
+module_exit(srf05_exit);
 
 MODULE_AUTHOR("Le Phuong Nam <le.phuong.nam@styl.solutions>");
 MODULE_DESCRIPTION("SRF05 ultrasonic sensor for distance measuring using GPIOs - IOCTL");
@@ -0,0 +1,245 @@
+/*
+ * SRF05: rate and jitter of the userspace engine (srf05-gpiod.c) against
+ * the kernel driver, one single shot after the other on each
+ *
+ *   gcc -O2 -Wall -o srf05-gpiod-bench srf05-gpiod-bench.c srf05-gpiod.c \
+ *	-lgpiod
+ *
+ *   srf05-gpiod-bench -c /dev/gpiochip0 -t 23 -e 24	userspace
+ *   srf05-gpiod-bench -d /dev/srf05			kernel driver
+ *
+ * both can be given, but the lines of a sensor bound to the driver are
+ * busy for libgpiod, so each runs on its own sensor then (or on the
+ * simulator, see srf05-sim.c).
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "srf05.h"
+#include "srf05-gpiod.h"
+
+struct srf05_stats {
+	const char	*name;
+	int		samples;
+	int		count;
+	int		ok;
+	int		timeouts;
+	int		range_errors;
+	int		others;
+	double		sum;
+	double		sum_sq;
+	int64_t		*cycle_ns;
+	int64_t		elapsed_ns;
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void account(struct srf05_stats *st, int distance, int64_t cycle)
+{
+	st->cycle_ns[st->count++] = cycle;
+
+	if (distance >= 0) {
+		st->ok++;
+		st->sum += distance;
+		st->sum_sq += (double)distance * distance;
+	} else if (distance == -ETIMEDOUT) {
+		st->timeouts++;
+	} else if (distance == -EIO) {
+		st->range_errors++;
+	} else {
+		st->others++;
+	}
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(struct srf05_stats *st)
+{
+	double mean = 0, sd = 0;
+
+	if (!st->count)
+		return;
+
+	if (st->ok) {
+		mean = st->sum / st->ok;
+		sd = sqrt(st->sum_sq / st->ok - mean * mean);
+	}
+	qsort(st->cycle_ns, st->count, sizeof(*st->cycle_ns), cmp_ns);
+
+	printf("%-7s %8.1f/s  ok %d  timeouts %d  range %d  other %d\n",
+		st->name, st->count * 1e9 / st->elapsed_ns, st->ok,
+		st->timeouts, st->range_errors, st->others);
+	printf("%-7s distance %.1f mm, sd %.2f mm\n", "", mean, sd);
+	printf("%-7s cycle p50 %.1f us, p99 %.1f us, max %.1f us\n", "",
+		st->cycle_ns[st->count / 2] / 1e3,
+		st->cycle_ns[st->count * 99 / 100] / 1e3,
+		st->cycle_ns[st->count - 1] / 1e3);
+}
+
+static int stats_init(struct srf05_stats *st, const char *name, int samples)
+{
+	memset(st, 0, sizeof(*st));
+	st->name = name;
+	st->samples = samples;
+	st->cycle_ns = calloc(samples, sizeof(*st->cycle_ns));
+
+	return st->cycle_ns ? 0 : -1;
+}
+
+static int bench_gpiod(struct srf05_stats *st, const char *chip,
+			unsigned int trig, unsigned int echo,
+			unsigned int flags, unsigned int range_mm)
+{
+	struct srf05_gpiod *s;
+	int64_t start, t;
+	int latency, jitter;
+	int i, distance;
+
+	s = srf05_gpiod_open(chip, trig, echo, flags);
+	if (!s) {
+		fprintf(stderr, "%s: %s\n", chip, strerror(errno));
+		return -1;
+	}
+	if (range_mm && srf05_gpiod_set_range(s, range_mm))
+		fprintf(stderr, "range %u mm not supported\n", range_mm);
+
+	start = now_ns();
+	for (i = 0; i < st->samples; i++) {
+		t = now_ns();
+		distance = srf05_gpiod_read(s, NULL);
+		account(st, distance, now_ns() - t);
+	}
+	st->elapsed_ns = now_ns() - start;
+
+	srf05_gpiod_capture(s, &latency, &jitter);
+	srf05_gpiod_close(s);
+
+	report(st);
+	printf("%-7s capture %s, latency %d ns, jitter %d ns\n", "",
+		flags & SRF05_GPIOD_HTE ? "hte" : "monotonic",
+		latency, jitter);
+
+	return 0;
+}
+
+static int bench_kernel(struct srf05_stats *st, const char *node)
+{
+	int64_t start, t;
+	int32_t value;
+	int i, fd;
+
+	fd = open(node, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", node, strerror(errno));
+		return -1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < st->samples; i++) {
+		t = now_ns();
+		if (ioctl(fd, READ_VALUE, &value) < 0)
+			value = -errno;
+		account(st, value, now_ns() - t);
+	}
+	st->elapsed_ns = now_ns() - start;
+
+	close(fd);
+
+	report(st);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c chip -t trig -e echo [-H]] [-d node] [-n count] [-r range_mm]\n"
+		"  -c  GPIO chip for the userspace engine, e.g. /dev/gpiochip0\n"
+		"  -t  offset of the trigger line\n"
+		"  -e  offset of the echo line\n"
+		"  -H  timestamp the echo with HTE\n"
+		"  -d  char device of the kernel driver, e.g. /dev/srf05\n"
+		"  -n  single shots per engine (default 1000)\n"
+		"  -r  max range in mm of the userspace engine\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct srf05_stats st;
+	const char *chip = NULL, *node = NULL;
+	unsigned int trig = 0, echo = 0, flags = 0, range_mm = 0;
+	int count = 1000;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "c:t:e:Hd:n:r:")) != -1) {
+		switch (opt) {
+		case 'c':
+			chip = optarg;
+			break;
+		case 't':
+			trig = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			echo = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			flags |= SRF05_GPIOD_HTE;
+			break;
+		case 'd':
+			node = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'r':
+			range_mm = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((!chip && !node) || count <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (chip) {
+		if (stats_init(&st, "gpiod", count))
+			return 1;
+		if (bench_gpiod(&st, chip, trig, echo, flags, range_mm))
+			ret = 1;
+		free(st.cycle_ns);
+	}
+
+	if (node) {
+		if (stats_init(&st, "kernel", count))
+			return 1;
+		if (bench_kernel(&st, node))
+			ret = 1;
+		free(st.cycle_ns);
+	}
+
+	return ret;
+}
@@ -0,0 +1,349 @@
+/*
+ * SRF05: ranging in userspace through libgpiod v2, see srf05-gpiod.h
+ *
+ * build together with a client:
+ *   gcc -O2 -Wall -o client client.c srf05-gpiod.c -lgpiod
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <gpiod.h>
+
+#include "srf05-gpiod.h"
+
+#define NSEC_PER_SEC		1000000000LL
+#define NSEC_PER_USEC		1000LL
+
+/* the same limits and defaults as the driver */
+#define SRF05_MAX_RANGE_MM	4000
+#define SRF05_MIN_RANGE_MM	10
+#define SRF05_TRIGGER_LATENCY_US 1000
+#define SRF05_GUARD_US		10000
+
+/* edges of one cycle plus some crosstalk */
+#define SRF05_EVENTS		16
+
+struct srf05_gpiod {
+	struct gpiod_chip		*chip;
+	struct gpiod_line_request	*request;
+	struct gpiod_edge_event_buffer	*events;
+	unsigned int			trig;
+	unsigned int			echo;
+
+	unsigned int			range_mm;
+	int64_t				echo_max_ns;
+	int64_t				cycle_timeout_ns;
+	uint32_t			speed_mmps;
+	int64_t				guard_ns;
+
+	int64_t				quiet_until;
+	uint32_t			seq;
+
+	bool				hte;
+
+	int				lat_mean;
+	int				lat_jitter;
+};
+
+static int64_t srf05_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void srf05_sleep_until(int64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / NSEC_PER_SEC,
+		.tv_nsec = ns % NSEC_PER_SEC,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+									EINTR)
+		;
+}
+
+int srf05_gpiod_set_range(struct srf05_gpiod *s, unsigned int range_mm)
+{
+	if (range_mm < SRF05_MIN_RANGE_MM || range_mm > SRF05_MAX_RANGE_MM)
+		return -EINVAL;
+
+	/* time of the sound to range_mm and back at 319 m/s (-20 °C) */
+	s->range_mm = range_mm;
+	s->echo_max_ns = (int64_t)range_mm * 2 * NSEC_PER_SEC / 319000;
+	s->cycle_timeout_ns = SRF05_TRIGGER_LATENCY_US * NSEC_PER_USEC +
+							s->echo_max_ns;
+
+	return 0;
+}
+
+int srf05_gpiod_set_temp(struct srf05_gpiod *s, int temp_mc)
+{
+	if (temp_mc < -40000 || temp_mc > 85000)
+		return -EINVAL;
+
+	/* 331,5 m/s + 0,6 m/s per °C */
+	s->speed_mmps = 331500 + temp_mc * 6 / 10;
+
+	return 0;
+}
+
+void srf05_gpiod_set_guard(struct srf05_gpiod *s, unsigned int guard_us)
+{
+	s->guard_ns = guard_us * NSEC_PER_USEC;
+}
+
+void srf05_gpiod_capture(struct srf05_gpiod *s, int *latency_ns,
+							int *jitter_ns)
+{
+	*latency_ns = s->lat_mean;
+	*jitter_ns = s->lat_jitter;
+}
+
+struct srf05_gpiod *srf05_gpiod_open(const char *path, unsigned int trig,
+					unsigned int echo, unsigned int flags)
+{
+	struct gpiod_request_config *req_cfg = NULL;
+	struct gpiod_line_settings *trig_set = NULL;
+	struct gpiod_line_settings *echo_set = NULL;
+	struct gpiod_line_config *line_cfg = NULL;
+	struct srf05_gpiod *s;
+	int err = ENOMEM;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->trig = trig;
+	s->echo = echo;
+	s->hte = flags & SRF05_GPIOD_HTE;
+	srf05_gpiod_set_range(s, 2000);
+	srf05_gpiod_set_temp(s, 26000);
+	srf05_gpiod_set_guard(s, SRF05_GUARD_US);
+
+	s->chip = gpiod_chip_open(path);
+	if (!s->chip) {
+		err = errno;
+		goto out;
+	}
+
+	trig_set = gpiod_line_settings_new();
+	echo_set = gpiod_line_settings_new();
+	line_cfg = gpiod_line_config_new();
+	req_cfg = gpiod_request_config_new();
+	s->events = gpiod_edge_event_buffer_new(SRF05_EVENTS);
+	if (!trig_set || !echo_set || !line_cfg || !req_cfg || !s->events)
+		goto out;
+
+	gpiod_line_settings_set_direction(trig_set,
+					GPIOD_LINE_DIRECTION_OUTPUT);
+	gpiod_line_settings_set_output_value(trig_set,
+					GPIOD_LINE_VALUE_INACTIVE);
+
+	gpiod_line_settings_set_direction(echo_set, GPIOD_LINE_DIRECTION_INPUT);
+	gpiod_line_settings_set_edge_detection(echo_set, GPIOD_LINE_EDGE_BOTH);
+	gpiod_line_settings_set_event_clock(echo_set,
+			flags & SRF05_GPIOD_HTE ? GPIOD_LINE_CLOCK_HTE :
+						GPIOD_LINE_CLOCK_MONOTONIC);
+
+	if (gpiod_line_config_add_line_settings(line_cfg, &trig, 1,
+							trig_set) ||
+	    gpiod_line_config_add_line_settings(line_cfg, &echo, 1,
+							echo_set)) {
+		err = errno;
+		goto out;
+	}
+
+	gpiod_request_config_set_consumer(req_cfg, "srf05");
+	gpiod_request_config_set_event_buffer_size(req_cfg, SRF05_EVENTS);
+
+	s->request = gpiod_chip_request_lines(s->chip, req_cfg, line_cfg);
+	if (!s->request) {
+		err = errno;
+		goto out;
+	}
+
+	err = 0;
+
+out:
+	gpiod_request_config_free(req_cfg);
+	gpiod_line_config_free(line_cfg);
+	gpiod_line_settings_free(echo_set);
+	gpiod_line_settings_free(trig_set);
+	if (err) {
+		srf05_gpiod_close(s);
+		errno = err;
+		return NULL;
+	}
+
+	return s;
+}
+
+void srf05_gpiod_close(struct srf05_gpiod *s)
+{
+	if (!s)
+		return;
+
+	if (s->request)
+		gpiod_line_request_release(s->request);
+	gpiod_edge_event_buffer_free(s->events);
+	if (s->chip)
+		gpiod_chip_close(s->chip);
+	free(s);
+}
+
+/* same as srf05_jitter_account() of the driver */
+static void srf05_jitter_account(struct srf05_gpiod *s, int64_t latency)
+{
+	if (latency < 0)
+		latency = 0;
+	if (latency > INT32_MAX)
+		latency = INT32_MAX;
+
+	if (!s->lat_mean) {
+		s->lat_mean = latency;
+		return;
+	}
+
+	s->lat_mean += ((int)latency - s->lat_mean) / 16;
+	s->lat_jitter += (abs((int)latency - s->lat_mean) -
+						s->lat_jitter) / 16;
+}
+
+/* events of earlier cycles, e.g. the end of an echo we gave up on */
+static int srf05_drain(struct srf05_gpiod *s)
+{
+	int ret;
+
+	while ((ret = gpiod_line_request_wait_edge_events(s->request, 0)) > 0)
+		if (gpiod_line_request_read_edge_events(s->request, s->events,
+							SRF05_EVENTS) < 0)
+			return -errno;
+
+	return ret < 0 ? -errno : 0;
+}
+
+static int srf05_pulse(struct srf05_gpiod *s, int64_t *ts_trigger)
+{
+	int64_t end;
+
+	if (gpiod_line_request_set_value(s->request, s->trig,
+						GPIOD_LINE_VALUE_ACTIVE))
+		return -errno;
+
+	/* 10 us are too short to sleep for */
+	end = srf05_now() + 10 * NSEC_PER_USEC;
+	while (srf05_now() < end)
+		;
+
+	if (gpiod_line_request_set_value(s->request, s->trig,
+						GPIOD_LINE_VALUE_INACTIVE))
+		return -errno;
+
+	*ts_trigger = srf05_now();
+
+	return 0;
+}
+
+/* distance in mm for an echo of dt_ns, as srf05_distance() */
+static int srf05_distance(struct srf05_gpiod *s, int64_t dt_ns)
+{
+	if (dt_ns > s->echo_max_ns)
+		return -EIO;
+
+	return (uint64_t)dt_ns * s->speed_mmps / 2000000000ULL;
+}
+
+int srf05_gpiod_read(struct srf05_gpiod *s, struct srf05_record *rec)
+{
+	struct gpiod_edge_event *event;
+	int64_t ts_trigger = 0, ts_rising = 0, hw_rising = 0, deadline, now;
+	bool started = false;
+	int distance = -ETIMEDOUT;
+	int ret, i, n;
+
+	/* the quiet time after the last ping, as the driver's scheduler */
+	srf05_sleep_until(s->quiet_until);
+
+	ret = srf05_drain(s);
+	if (ret)
+		return ret;
+
+	/* the sensor ignores the trigger while it still sends an echo */
+	ret = gpiod_line_request_get_value(s->request, s->echo);
+	if (ret < 0)
+		return -errno;
+	if (ret == GPIOD_LINE_VALUE_ACTIVE)
+		return -EBUSY;
+
+	ret = srf05_pulse(s, &ts_trigger);
+	if (ret)
+		return ret;
+	deadline = ts_trigger + s->cycle_timeout_ns;
+
+	for (;;) {
+		now = srf05_now();
+		if (now >= deadline) {
+			distance = started ? -EIO : -ETIMEDOUT;
+			break;
+		}
+
+		ret = gpiod_line_request_wait_edge_events(s->request,
+							deadline - now);
+		if (ret < 0)
+			return -errno;
+		if (!ret)
+			continue;
+
+		n = gpiod_line_request_read_edge_events(s->request, s->events,
+							SRF05_EVENTS);
+		if (n < 0)
+			return -errno;
+
+		for (i = 0; i < n; i++) {
+			int64_t ts, mono;
+
+			event = gpiod_edge_event_buffer_get_event(s->events, i);
+			ts = gpiod_edge_event_get_timestamp_ns(event);
+			/*
+			 * HTE timestamps are in the clock of the provider and
+			 * only good for the pulse width, the rest stays on
+			 * CLOCK_MONOTONIC with the time the event was read
+			 */
+			mono = s->hte ? srf05_now() : ts;
+
+			if (gpiod_edge_event_get_event_type(event) ==
+					GPIOD_EDGE_EVENT_RISING_EDGE) {
+				ts_rising = mono;
+				hw_rising = ts;
+				started = true;
+				srf05_jitter_account(s, mono - ts_trigger);
+			} else if (started) {
+				distance = srf05_distance(s, ts - hw_rising);
+				goto done;
+			}
+		}
+	}
+
+done:
+	s->quiet_until = srf05_now() + (s->guard_ns < s->echo_max_ns ?
+					s->guard_ns : s->echo_max_ns);
+
+	if (rec) {
+		memset(rec, 0, sizeof(*rec));
+		rec->distance = distance < 0 ? 0 : distance;
+		rec->status = distance < 0 ? distance : 0;
+		rec->seq = s->seq;
+		rec->timestamp = started ? ts_rising : ts_trigger;
+	}
+	s->seq++;
+
+	return distance;
+}
@@ -0,0 +1,52 @@
+/*
+ * SRF05: ranging in userspace through libgpiod v2
+ *
+ * the same cycle as the kernel driver (mod.c) for boards where it cannot
+ * be loaded: the trigger is pulsed through a line request, the echo
+ * edges come in as edge events timestamped by the kernel (or by the
+ * hardware timestamping engine with SRF05_GPIOD_HTE) and the distance
+ * math and range rejection are the ones of the driver.
+ *
+ * not thread safe, one struct srf05_gpiod per sensor and thread
+ */
+#ifndef SRF05_GPIOD_H
+#define SRF05_GPIOD_H
+
+#include "srf05.h"
+
+/* timestamp the echo edges with HTE instead of the interrupt time */
+#define SRF05_GPIOD_HTE		0x1
+
+struct srf05_gpiod;
+
+/*
+ * requests trig (output, low) and echo (input, both edges) on the chip
+ * at path, e.g. /dev/gpiochip0; NULL with errno set on failure
+ */
+struct srf05_gpiod *srf05_gpiod_open(const char *path, unsigned int trig,
+					unsigned int echo, unsigned int flags);
+void srf05_gpiod_close(struct srf05_gpiod *s);
+
+/* like the max_range_mm and ambient_temp attributes of the driver */
+int srf05_gpiod_set_range(struct srf05_gpiod *s, unsigned int range_mm);
+int srf05_gpiod_set_temp(struct srf05_gpiod *s, int temp_mc);
+
+/* like the sched_guard_us parameter of the driver */
+void srf05_gpiod_set_guard(struct srf05_gpiod *s, unsigned int guard_us);
+
+/*
+ * one ranging cycle like READ_VALUE: returns the distance in mm or a
+ * negative errno (-ETIMEDOUT without echo, -EIO for an echo from beyond
+ * the range, -EBUSY if the echo line is still high); rec may be NULL,
+ * otherwise it is filled like a record read() from /dev/srf05
+ */
+int srf05_gpiod_read(struct srf05_gpiod *s, struct srf05_record *rec);
+
+/*
+ * EWMA of the trigger to rising echo latency and its mean deviation in
+ * ns, like debugfs <dev>/capture of the driver
+ */
+void srf05_gpiod_capture(struct srf05_gpiod *s, int *latency_ns,
+							int *jitter_ns);
+
+#endif
@@ -0,0 +1,493 @@
+/*
+ * SRF05 simulator: a GPIO chip behaving like SRF05 sensors for mod.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * the module registers a GPIO chip "srf05-sim" with two lines per
+ * simulated sensor (trig at 2 * n, echo at 2 * n + 1) and one
+ * "srf05-gpio" platform device per sensor with a GPIO lookup table
+ * pointing at them, so the SRF05 driver binds to the simulated sensors
+ * the same way it binds to real ones from DT.
+ *
+ * like the real sensor a simulated one starts its burst on the falling
+ * edge of the trigger and ignores the trigger while it is busy. After
+ * latency_us the echo line goes high for the time the sound takes to
+ * distance_mm and back, plus a uniform noise of up to noise_mm. The echo
+ * interrupt comes from an irq_sim domain, so it arrives through
+ * irq_work just like on a box with a real GPIO interrupt controller.
+ *
+ * timeout_pct percent of the pings are never answered (the driver
+ * reports -ETIMEDOUT) and dropout_pct percent see no object, which the
+ * sensor signals with an echo pulse of 30 ms (the driver reports -EIO
+ * unless max_range_mm is beyond 5 m).
+ *
+ * all parameters except sensors can be changed at runtime under
+ * /sys/module/srf05_sim/parameters/. /sys/kernel/debug/srf05-sim/stats
+ * counts what the simulated sensors have seen. See bench.sh for a
+ * benchmark of the driver on top of this.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/platform_device.h>
+#include <linux/gpio/driver.h>
+#include <linux/gpio/machine.h>
+#include <linux/irq.h>
+#include <linux/irq_sim.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/random.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/atomic.h>
+#include <linux/version.h>
+
+#define SRF05_SIM_NAME		"srf05-sim"
+#define SRF05_SIM_MAX_SENSORS	4
+
+/* length of the echo pulse when the sensor does not see any object */
+#define SRF05_SIM_NO_OBJECT_US	30000
+
+static unsigned int sensors = 1;
+module_param(sensors, uint, 0444);
+MODULE_PARM_DESC(sensors, "number of simulated sensors (1-4)");
+
+static unsigned int distance_mm = 1000;
+module_param(distance_mm, uint, 0644);
+MODULE_PARM_DESC(distance_mm, "distance of the simulated object");
+
+static unsigned int noise_mm;
+module_param(noise_mm, uint, 0644);
+MODULE_PARM_DESC(noise_mm, "uniform noise added to distance_mm");
+
+static unsigned int latency_us = 700;
+module_param(latency_us, uint, 0644);
+MODULE_PARM_DESC(latency_us, "time from the trigger to the rising echo");
+
+static int temp_mc = 26000;
+module_param(temp_mc, int, 0644);
+MODULE_PARM_DESC(temp_mc, "air temperature in m°C the sound travels at");
+
+static unsigned int dropout_pct;
+module_param(dropout_pct, uint, 0644);
+MODULE_PARM_DESC(dropout_pct, "percent of pings seeing no object");
+
+static unsigned int timeout_pct;
+module_param(timeout_pct, uint, 0644);
+MODULE_PARM_DESC(timeout_pct, "percent of pings never answered");
+
+struct srf05_sim;
+
+struct srf05_sim_sensor {
+	struct srf05_sim	*sim;
+	unsigned int		index;
+	struct hrtimer		timer;
+
+	/* protected by srf05_sim.lock */
+	bool			trig;
+	bool			echo;
+	bool			busy;
+	ktime_t			width;
+};
+
+struct srf05_sim {
+	struct gpio_chip	chip;
+	spinlock_t		lock;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	struct irq_domain	*irq_domain;
+#else
+	struct irq_sim		irq_sim;
+#endif
+	struct srf05_sim_sensor	sensor[SRF05_SIM_MAX_SENSORS];
+
+	/* statistics */
+	atomic_long_t		pings;
+	atomic_long_t		ignored;
+	atomic_long_t		echos;
+	atomic_long_t		dropouts;
+	atomic_long_t		timeouts;
+};
+
+static struct platform_device *srf05_sim_pdev;
+static struct platform_device *srf05_sim_sensor_pdev[SRF05_SIM_MAX_SENSORS];
+static struct gpiod_lookup_table *srf05_sim_lookup[SRF05_SIM_MAX_SENSORS];
+static struct dentry *srf05_sim_debugfs;
+
+static void srf05_sim_fire(struct srf05_sim_sensor *sensor)
+{
+	struct srf05_sim *sim = sensor->sim;
+	unsigned int offset = 2 * sensor->index + 1;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	irq_set_irqchip_state(irq_find_mapping(sim->irq_domain, offset),
+					IRQCHIP_STATE_PENDING, true);
+#else
+	irq_sim_fire(&sim->irq_sim, offset);
+#endif
+}
+
+/* echo pulse width of an object at distance_mm, with noise */
+static ktime_t srf05_sim_width(void)
+{
+	/* same approximation as the driver: 331,5 m/s + 0,6 m/s per °C */
+	u32 speed_mmps = 331500 + READ_ONCE(temp_mc) * 6 / 10;
+	unsigned int noise = READ_ONCE(noise_mm);
+	s64 distance = READ_ONCE(distance_mm);
+
+	if (noise)
+		distance += (s64)(get_random_u32() % (2 * noise + 1)) - noise;
+	if (distance < 0)
+		distance = 0;
+
+	return ns_to_ktime(div_u64((u64)distance * 2 * NSEC_PER_SEC,
+							speed_mmps));
+}
+
+/* called with sim->lock held on the falling edge of the trigger */
+static void srf05_sim_ping(struct srf05_sim_sensor *sensor)
+{
+	struct srf05_sim *sim = sensor->sim;
+	unsigned int roll;
+
+	atomic_long_inc(&sim->pings);
+
+	if (sensor->busy) {
+		atomic_long_inc(&sim->ignored);
+		return;
+	}
+
+	roll = get_random_u32() % 100;
+	if (roll < READ_ONCE(timeout_pct)) {
+		atomic_long_inc(&sim->timeouts);
+		return;
+	}
+
+	if (roll < READ_ONCE(timeout_pct) + READ_ONCE(dropout_pct)) {
+		atomic_long_inc(&sim->dropouts);
+		sensor->width = us_to_ktime(SRF05_SIM_NO_OBJECT_US);
+	} else {
+		sensor->width = srf05_sim_width();
+	}
+
+	sensor->busy = true;
+	hrtimer_start(&sensor->timer, us_to_ktime(READ_ONCE(latency_us)),
+							HRTIMER_MODE_REL);
+}
+
+/* rising and falling edge of the echo */
+static enum hrtimer_restart srf05_sim_tick(struct hrtimer *timer)
+{
+	struct srf05_sim_sensor *sensor =
+		container_of(timer, struct srf05_sim_sensor, timer);
+	struct srf05_sim *sim = sensor->sim;
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	if (!sensor->echo) {
+		sensor->echo = true;
+		hrtimer_forward_now(timer, sensor->width);
+		ret = HRTIMER_RESTART;
+	} else {
+		sensor->echo = false;
+		sensor->busy = false;
+		atomic_long_inc(&sim->echos);
+	}
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	srf05_sim_fire(sensor);
+
+	return ret;
+}
+
+static int srf05_sim_get_direction(struct gpio_chip *chip,
+						unsigned int offset)
+{
+	/* 1: input; the echo lines are the odd ones */
+	return offset & 1;
+}
+
+static int srf05_sim_direction_input(struct gpio_chip *chip,
+						unsigned int offset)
+{
+	return offset & 1 ? 0 : -EPERM;
+}
+
+static int srf05_sim_get(struct gpio_chip *chip, unsigned int offset)
+{
+	struct srf05_sim *sim = gpiochip_get_data(chip);
+	struct srf05_sim_sensor *sensor = &sim->sensor[offset / 2];
+	unsigned long flags;
+	int value;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	value = offset & 1 ? sensor->echo : sensor->trig;
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return value;
+}
+
+static void srf05_sim_set(struct gpio_chip *chip, unsigned int offset,
+								int value)
+{
+	struct srf05_sim *sim = gpiochip_get_data(chip);
+	struct srf05_sim_sensor *sensor = &sim->sensor[offset / 2];
+	unsigned long flags;
+
+	if (offset & 1)
+		return;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	if (sensor->trig && !value)
+		srf05_sim_ping(sensor);
+	sensor->trig = value;
+	spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static int srf05_sim_direction_output(struct gpio_chip *chip,
+					unsigned int offset, int value)
+{
+	if (offset & 1)
+		return -EPERM;
+
+	srf05_sim_set(chip, offset, value);
+
+	return 0;
+}
+
+static int srf05_sim_to_irq(struct gpio_chip *chip, unsigned int offset)
+{
+	struct srf05_sim *sim = gpiochip_get_data(chip);
+
+	if (!(offset & 1))
+		return -ENXIO;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	return irq_create_mapping(sim->irq_domain, offset);
+#else
+	return irq_sim_irqnum(&sim->irq_sim, offset);
+#endif
+}
+
+static int srf05_sim_stats_show(struct seq_file *s, void *unused)
+{
+	struct srf05_sim *sim = s->private;
+
+	seq_printf(s, "pings %lu\n", atomic_long_read(&sim->pings));
+	seq_printf(s, "ignored %lu\n", atomic_long_read(&sim->ignored));
+	seq_printf(s, "echos %lu\n", atomic_long_read(&sim->echos));
+	seq_printf(s, "dropouts %lu\n", atomic_long_read(&sim->dropouts));
+	seq_printf(s, "timeouts %lu\n", atomic_long_read(&sim->timeouts));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(srf05_sim_stats);
+
+static int srf05_sim_probe(struct platform_device *pdev)
+{
+	struct device *dev = &pdev->dev;
+	struct srf05_sim *sim;
+	unsigned int i;
+	int ret;
+
+	sim = devm_kzalloc(dev, sizeof(*sim), GFP_KERNEL);
+	if (!sim)
+		return -ENOMEM;
+
+	spin_lock_init(&sim->lock);
+	for (i = 0; i < sensors; i++) {
+		sim->sensor[i].sim = sim;
+		sim->sensor[i].index = i;
+		hrtimer_init(&sim->sensor[i].timer, CLOCK_MONOTONIC,
+							HRTIMER_MODE_REL);
+		sim->sensor[i].timer.function = srf05_sim_tick;
+	}
+
+	sim->chip.label = SRF05_SIM_NAME;
+	sim->chip.parent = dev;
+	sim->chip.owner = THIS_MODULE;
+	sim->chip.base = -1;
+	sim->chip.ngpio = 2 * sensors;
+	sim->chip.can_sleep = false;
+	sim->chip.get_direction = srf05_sim_get_direction;
+	sim->chip.direction_input = srf05_sim_direction_input;
+	sim->chip.direction_output = srf05_sim_direction_output;
+	sim->chip.get = srf05_sim_get;
+	sim->chip.set = srf05_sim_set;
+	sim->chip.to_irq = srf05_sim_to_irq;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	sim->irq_domain = devm_irq_domain_create_sim(dev, NULL,
+							sim->chip.ngpio);
+	if (IS_ERR(sim->irq_domain))
+		return PTR_ERR(sim->irq_domain);
+#else
+	ret = devm_irq_sim_init(dev, &sim->irq_sim, sim->chip.ngpio);
+	if (ret < 0)
+		return ret;
+#endif
+
+	ret = devm_gpiochip_add_data(dev, &sim->chip, sim);
+	if (ret) {
+		dev_err(dev, "failed to add GPIO chip: %d\n", ret);
+		return ret;
+	}
+
+	platform_set_drvdata(pdev, sim);
+
+	debugfs_create_file("stats", 0444, srf05_sim_debugfs, sim,
+						&srf05_sim_stats_fops);
+
+	return 0;
+}
+
+static int srf05_sim_remove(struct platform_device *pdev)
+{
+	struct srf05_sim *sim = platform_get_drvdata(pdev);
+	unsigned int i;
+
+	for (i = 0; i < sensors; i++)
+		hrtimer_cancel(&sim->sensor[i].timer);
+
+	return 0;
+}
+
+static struct platform_driver srf05_sim_driver = {
+	.probe		= srf05_sim_probe,
+	.remove		= srf05_sim_remove,
+	.driver		= {
+		.name	= SRF05_SIM_NAME,
+	},
+};
+
+/* lets "srf05-gpio.<n>" find its trig and echo line on the simulator */
+static struct gpiod_lookup_table *srf05_sim_lookup_alloc(unsigned int n)
+{
+	struct gpiod_lookup_table *table;
+
+	table = kzalloc(sizeof(*table) + 3 * sizeof(table->table[0]),
+								GFP_KERNEL);
+	if (!table)
+		return NULL;
+
+	table->dev_id = kasprintf(GFP_KERNEL, "srf05-gpio.%u", n);
+	if (!table->dev_id) {
+		kfree(table);
+		return NULL;
+	}
+
+	table->table[0].chip_label = SRF05_SIM_NAME;
+	table->table[0].chip_hwnum = 2 * n;
+	table->table[0].con_id = "trig";
+	table->table[0].flags = GPIO_ACTIVE_HIGH;
+	table->table[1].chip_label = SRF05_SIM_NAME;
+	table->table[1].chip_hwnum = 2 * n + 1;
+	table->table[1].con_id = "echo";
+	table->table[1].flags = GPIO_ACTIVE_HIGH;
+
+	return table;
+}
+
+static void srf05_sim_lookup_free(struct gpiod_lookup_table *table)
+{
+	kfree(table->dev_id);
+	kfree(table);
+}
+
+static void srf05_sim_sensors_del(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < SRF05_SIM_MAX_SENSORS; i++) {
+		if (srf05_sim_sensor_pdev[i]) {
+			platform_device_unregister(srf05_sim_sensor_pdev[i]);
+			srf05_sim_sensor_pdev[i] = NULL;
+		}
+		if (srf05_sim_lookup[i]) {
+			gpiod_remove_lookup_table(srf05_sim_lookup[i]);
+			srf05_sim_lookup_free(srf05_sim_lookup[i]);
+			srf05_sim_lookup[i] = NULL;
+		}
+	}
+}
+
+static int __init srf05_sim_init(void)
+{
+	struct platform_device *pdev;
+	unsigned int i;
+	int ret;
+
+	if (!sensors || sensors > SRF05_SIM_MAX_SENSORS) {
+		pr_err(SRF05_SIM_NAME ": sensors must be 1-%d\n",
+						SRF05_SIM_MAX_SENSORS);
+		return -EINVAL;
+	}
+
+	srf05_sim_debugfs = debugfs_create_dir(SRF05_SIM_NAME, NULL);
+
+	ret = platform_driver_register(&srf05_sim_driver);
+	if (ret)
+		goto err_debugfs;
+
+	srf05_sim_pdev = platform_device_register_simple(SRF05_SIM_NAME,
+						PLATFORM_DEVID_NONE, NULL, 0);
+	if (IS_ERR(srf05_sim_pdev)) {
+		ret = PTR_ERR(srf05_sim_pdev);
+		goto err_driver;
+	}
+
+	for (i = 0; i < sensors; i++) {
+		srf05_sim_lookup[i] = srf05_sim_lookup_alloc(i);
+		if (!srf05_sim_lookup[i]) {
+			ret = -ENOMEM;
+			goto err_sensors;
+		}
+		gpiod_add_lookup_table(srf05_sim_lookup[i]);
+
+		/* matches the SRF05 driver by name */
+		pdev = platform_device_register_simple("srf05-gpio", i,
+								NULL, 0);
+		if (IS_ERR(pdev)) {
+			ret = PTR_ERR(pdev);
+			goto err_sensors;
+		}
+		srf05_sim_sensor_pdev[i] = pdev;
+	}
+
+	return 0;
+
+err_sensors:
+	srf05_sim_sensors_del();
+	platform_device_unregister(srf05_sim_pdev);
+err_driver:
+	platform_driver_unregister(&srf05_sim_driver);
+err_debugfs:
+	debugfs_remove_recursive(srf05_sim_debugfs);
+	return ret;
+}
+
+static void __exit srf05_sim_exit(void)
+{
+	srf05_sim_sensors_del();
+	platform_device_unregister(srf05_sim_pdev);
+	platform_driver_unregister(&srf05_sim_driver);
+	debugfs_remove_recursive(srf05_sim_debugfs);
+}
+
+module_init(srf05_sim_init);
+module_exit(srf05_sim_exit);
+
+MODULE_AUTHOR("Le Phuong Nam <le.phuong.nam@styl.solutions>");
+MODULE_DESCRIPTION("SRF05 simulator on a GPIO chip for testing the SRF05 driver");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,109 @@
+/*
+ * SRF05: interface of the /dev/srf05* char devices
+ *
+ * shared between the kernel driver (mod.c) and its userspace clients
+ */
+#ifndef SRF05_H
+#define SRF05_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define IOCTL_APP_TYPE 71
+
+/*
+ * one ranging cycle, returns the distance in mm or a negative errno;
+ * the size encoded in the number is the one of a pointer for
+ * compatibility with the first clients
+ */
+#define READ_VALUE _IOR(IOCTL_APP_TYPE,2,__s32*)
+
+/*
+ * one completed ranging cycle as returned by read() and READ_BATCH
+ */
+struct srf05_record {
+	__s32	distance;	/* mm, 0 if status is set */
+	__u32	seq;		/* per device sequence number */
+	__s64	timestamp;	/* ns, CLOCK_MONOTONIC, start of the echo */
+	__s32	status;		/* 0 or negative errno of the cycle */
+	__u32	reserved;
+};
+
+/*
+ * fill up to count records into the array at records; count is updated
+ * to the number of records copied. Like read() it sleeps until at least
+ * one record is pending unless the file is opened O_NONBLOCK.
+ */
+struct srf05_batch {
+	__u64	records;	/* struct srf05_record __user * */
+	__u32	count;
+	__u32	reserved;
+};
+
+#define READ_BATCH _IOWR(IOCTL_APP_TYPE,3,struct srf05_batch)
+
+/*
+ * asynchronous ranging: START_MEASUREMENT asks for a ping and returns
+ * right away, dropping the records still pending for the file. poll()
+ * then reports POLLIN once the measurement is published and GET_RESULT
+ * hands it out (or fails with EAGAIN on an O_NONBLOCK file while it is
+ * still in flight). One thread can drive many sensors this way.
+ */
+#define START_MEASUREMENT _IO(IOCTL_APP_TYPE,4)
+#define GET_RESULT _IOR(IOCTL_APP_TYPE,5,struct srf05_record)
+
+/*
+ * the record ring of a device can be mmap()ed. The first page holds
+ * struct srf05_ring_header, the records follow at records_offset. Only
+ * the header page may be mapped writable, it carries the position of
+ * the one mmap consumer of the device: poll() on a file which mapped the
+ * ring reports POLLIN while head != tail.
+ *
+ * the driver writes a record and then publishes it by a release store
+ * to head, so the last size - 1 records before head are stable; a record
+ * is only valid if head has not moved size or more past it while it was
+ * copied, see srf05_ring_read()
+ */
+struct srf05_ring_header {
+	__u32	head;		/* records ever written, by the driver */
+	__u32	tail;		/* records consumed, by the consumer */
+	__u32	size;		/* records in the ring, a power of 2 */
+	__u32	record_size;
+	__u32	records_offset;	/* of the first record in the mapping */
+	__u32	reserved[3];
+};
+
+#ifndef __KERNEL__
+/*
+ * copies up to max records pending in a mapped ring to out and advances
+ * the tail; records overwritten before they could be read are skipped
+ */
+static inline unsigned int srf05_ring_read(struct srf05_ring_header *hdr,
+			const struct srf05_record *ring,
+			struct srf05_record *out, unsigned int max)
+{
+	__u32 size = hdr->size;
+	__u32 tail = hdr->tail;
+	__u32 head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	unsigned int n = 0;
+
+	while (tail != head && n < max) {
+		if (head - tail >= size)
+			tail = head - size + 1;
+		out[n] = ring[tail & (size - 1)];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		/* the slot was reused while copying, try the next one */
+		if (head - tail >= size)
+			continue;
+		n++;
+		tail++;
+	}
+
+	__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+
+	return n;
+}
+#endif
+
+#endif /* SRF05_H */
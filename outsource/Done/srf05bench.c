@@ -0,0 +1,478 @@
+/*
+ * srf05bench: rate, latency and jitter of the SRF05 driver as seen from
+ * userspace
+ *
+ *   gcc -O2 -Wall -o srf05bench srf05bench.c -lpthread -lm
+ *
+ * every thread opens the device on its own and reads from it in one of
+ * the ways the driver offers (-m):
+ *
+ *   ioctl	READ_VALUE, a blocking single shot per call
+ *   async	START_MEASUREMENT, poll() and GET_RESULT
+ *   read	read() of the records pending for the file
+ *   batch	READ_BATCH, same as read with an ioctl
+ *   mmap	the mapped record ring with poll() as doorbell, one thread
+ *
+ * read, batch and mmap only see samples while the engine runs (set
+ * engine_period_us) or someone else pings, and every thread sees every
+ * sample. The latency is the time of the call for ioctl and async and
+ * the time from the echo to the sample arriving in userspace for the
+ * others; the jitter is the standard deviation of the interval between
+ * consecutive samples of a thread.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "srf05.h"
+
+/* records fetched per call in the streaming modes */
+#define CHUNK		64
+#define POLL_MS		100
+
+enum mode {
+	MODE_IOCTL,
+	MODE_ASYNC,
+	MODE_READ,
+	MODE_BATCH,
+	MODE_MMAP,
+};
+
+static const char * const mode_names[] = {
+	[MODE_IOCTL]	= "ioctl",
+	[MODE_ASYNC]	= "async",
+	[MODE_READ]	= "read",
+	[MODE_BATCH]	= "batch",
+	[MODE_MMAP]	= "mmap",
+};
+
+struct series {
+	int64_t		*v;
+	size_t		n;
+	size_t		cap;
+};
+
+struct worker {
+	pthread_t	thread;
+	int		index;
+	int		ret;
+	struct series	latency;
+	struct series	interval;
+	int64_t		last;
+	long		samples;
+	long		timeouts;
+	long		errors;
+};
+
+static const char *device = "/dev/srf05";
+static enum mode mode = MODE_IOCTL;
+static int duration = 10;
+static int threads = 1;
+static int cpu = -1;
+static int fifo_prio;
+static bool json;
+
+static int64_t deadline;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void series_add(struct series *s, int64_t v)
+{
+	if (s->n == s->cap) {
+		size_t cap = s->cap ? 2 * s->cap : 4096;
+		int64_t *p = realloc(s->v, cap * sizeof(*p));
+
+		/* keep what we have rather than give up the run */
+		if (!p)
+			return;
+		s->v = p;
+		s->cap = cap;
+	}
+	s->v[s->n++] = v;
+}
+
+static void series_merge(struct series *to, struct series *from)
+{
+	size_t i;
+
+	for (i = 0; i < from->n; i++)
+		series_add(to, from->v[i]);
+	free(from->v);
+}
+
+static int cmp_s64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* of a sorted series, in us */
+static double percentile(struct series *s, int permille)
+{
+	if (!s->n)
+		return 0;
+
+	return s->v[(s->n - 1) * permille / 1000] / 1e3;
+}
+
+/* one result; ts is the time the sample belongs to */
+static void account(struct worker *w, int status, int64_t latency,
+							int64_t ts)
+{
+	w->samples++;
+	if (status == -ETIMEDOUT)
+		w->timeouts++;
+	else if (status < 0)
+		w->errors++;
+
+	series_add(&w->latency, latency);
+	if (w->last)
+		series_add(&w->interval, ts - w->last);
+	w->last = ts;
+}
+
+static int run_ioctl(struct worker *w, int fd)
+{
+	int64_t t0, t1;
+	int32_t value;
+	int ret;
+
+	while ((t0 = now_ns()) < deadline) {
+		ret = ioctl(fd, READ_VALUE, &value);
+		t1 = now_ns();
+		if (ret < 0 && errno == EINTR)
+			continue;
+		account(w, ret < 0 ? -errno : 0, t1 - t0, t1);
+	}
+
+	return 0;
+}
+
+static int run_async(struct worker *w, int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct srf05_record rec;
+	int64_t t0;
+	int ret;
+
+	while ((t0 = now_ns()) < deadline) {
+		if (ioctl(fd, START_MEASUREMENT) < 0)
+			return -errno;
+
+		do {
+			ret = poll(&pfd, 1, POLL_MS);
+		} while (!ret && now_ns() < deadline);
+		if (ret <= 0)
+			break;
+
+		if (ioctl(fd, GET_RESULT, &rec) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			account(w, -errno, now_ns() - t0, now_ns());
+			continue;
+		}
+		account(w, rec.status, now_ns() - t0, rec.timestamp);
+	}
+
+	return 0;
+}
+
+/* read, batch and mmap: take what is pending whenever poll() says so */
+static int run_stream(struct worker *w, int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct srf05_record recs[CHUNK];
+	struct srf05_ring_header *hdr = NULL;
+	struct srf05_record *ring = NULL;
+	size_t ring_len = 0;
+	struct srf05_batch batch;
+	int64_t t;
+	long n, i;
+
+	if (mode == MODE_MMAP) {
+		hdr = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE,
+							MAP_SHARED, fd, 0);
+		if (hdr == MAP_FAILED)
+			return -errno;
+		ring_len = (size_t)hdr->size * hdr->record_size;
+		ring = mmap(NULL, ring_len, PROT_READ, MAP_SHARED, fd,
+							hdr->records_offset);
+		if (ring == MAP_FAILED) {
+			munmap(hdr, sysconf(_SC_PAGESIZE));
+			return -errno;
+		}
+		/* only what comes from now on */
+		hdr->tail = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	}
+
+	while (now_ns() < deadline) {
+		if (poll(&pfd, 1, POLL_MS) <= 0)
+			continue;
+
+		switch (mode) {
+		case MODE_MMAP:
+			n = srf05_ring_read(hdr, ring, recs, CHUNK);
+			break;
+		case MODE_BATCH:
+			batch.records = (uintptr_t)recs;
+			batch.count = CHUNK;
+			n = ioctl(fd, READ_BATCH, &batch) < 0 ? -1 :
+							(long)batch.count;
+			break;
+		default:
+			n = read(fd, recs, sizeof(recs));
+			if (n > 0)
+				n /= sizeof(recs[0]);
+			break;
+		}
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		t = now_ns();
+		for (i = 0; i < n; i++)
+			account(w, recs[i].status, t - recs[i].timestamp,
+							recs[i].timestamp);
+	}
+
+	if (mode == MODE_MMAP) {
+		munmap(ring, ring_len);
+		munmap(hdr, sysconf(_SC_PAGESIZE));
+	}
+
+	return 0;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	int fd;
+
+	if (cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cpu + w->index, &set);
+		if (sched_setaffinity(0, sizeof(set), &set))
+			fprintf(stderr, "thread %d: cannot pin to cpu %d: %s\n",
+				w->index, cpu + w->index, strerror(errno));
+	}
+
+	if (fifo_prio) {
+		struct sched_param param = { .sched_priority = fifo_prio };
+
+		errno = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+								&param);
+		if (errno)
+			fprintf(stderr, "thread %d: no SCHED_FIFO: %s\n",
+				w->index, strerror(errno));
+	}
+
+	fd = open(device, O_RDONLY | (mode == MODE_IOCTL ? 0 : O_NONBLOCK));
+	if (fd < 0) {
+		w->ret = -errno;
+		fprintf(stderr, "%s: %s\n", device, strerror(-w->ret));
+		return NULL;
+	}
+
+	switch (mode) {
+	case MODE_IOCTL:
+		w->ret = run_ioctl(w, fd);
+		break;
+	case MODE_ASYNC:
+		w->ret = run_async(w, fd);
+		break;
+	default:
+		w->ret = run_stream(w, fd);
+		break;
+	}
+	if (w->ret)
+		fprintf(stderr, "thread %d: %s\n", w->index, strerror(-w->ret));
+
+	close(fd);
+
+	return NULL;
+}
+
+static void report(struct worker *total, double seconds)
+{
+	double mean = 0, var = 0, rate = total->samples / seconds;
+	double timeout_rate = 0, error_rate = 0;
+	size_t i;
+
+	for (i = 0; i < total->interval.n; i++)
+		mean += total->interval.v[i];
+	if (total->interval.n)
+		mean /= total->interval.n;
+	for (i = 0; i < total->interval.n; i++)
+		var += (total->interval.v[i] - mean) *
+					(total->interval.v[i] - mean);
+	if (total->interval.n > 1)
+		var /= total->interval.n - 1;
+
+	if (total->samples) {
+		timeout_rate = (double)total->timeouts / total->samples;
+		error_rate = (double)total->errors / total->samples;
+	}
+
+	qsort(total->latency.v, total->latency.n, sizeof(int64_t), cmp_s64);
+
+	if (json) {
+		printf("{\"device\": \"%s\", \"mode\": \"%s\", "
+			"\"threads\": %d, \"duration_s\": %.3f, "
+			"\"samples\": %ld, \"samples_per_s\": %.1f, "
+			"\"timeouts\": %ld, \"errors\": %ld, "
+			"\"timeout_rate\": %.6f, \"error_rate\": %.6f, "
+			"\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, "
+			"\"p999\": %.1f}, "
+			"\"interval_us\": {\"mean\": %.1f, \"jitter\": %.1f}}\n",
+			device, mode_names[mode], threads, seconds,
+			total->samples, rate, total->timeouts, total->errors,
+			timeout_rate, error_rate,
+			percentile(&total->latency, 500),
+			percentile(&total->latency, 990),
+			percentile(&total->latency, 999),
+			mean / 1e3, sqrt(var) / 1e3);
+		return;
+	}
+
+	printf("%s, %s, %d thread(s), %.1f s\n", device, mode_names[mode],
+							threads, seconds);
+	printf("samples   %ld (%.1f/s)\n", total->samples, rate);
+	printf("timeouts  %ld (%.3f %%)\n", total->timeouts,
+							timeout_rate * 100);
+	printf("errors    %ld (%.3f %%)\n", total->errors, error_rate * 100);
+	printf("latency   p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+		percentile(&total->latency, 500),
+		percentile(&total->latency, 990),
+		percentile(&total->latency, 999));
+	printf("interval  mean %.1f us, jitter %.1f us\n", mean / 1e3,
+							sqrt(var) / 1e3);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-m mode] [-t seconds] [-n threads] [-c cpu] [-f prio] [-j]\n"
+		"  -d  char device (default /dev/srf05)\n"
+		"  -m  ioctl, async, read, batch or mmap (default ioctl)\n"
+		"  -t  duration in seconds (default 10)\n"
+		"  -n  threads (default 1)\n"
+		"  -c  pin thread i to cpu + i\n"
+		"  -f  run the threads SCHED_FIFO at this priority\n"
+		"  -j  JSON output\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct worker *workers, total;
+	int64_t start;
+	int opt, i, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:m:t:n:c:f:j")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'm':
+			for (i = 0; i <= MODE_MMAP; i++)
+				if (!strcmp(optarg, mode_names[i]))
+					break;
+			if (i > MODE_MMAP) {
+				usage(argv[0]);
+				return 1;
+			}
+			mode = i;
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'n':
+			threads = atoi(optarg);
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'f':
+			fifo_prio = atoi(optarg);
+			break;
+		case 'j':
+			json = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (duration <= 0 || threads <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* the ring header has room for the position of one consumer */
+	if (mode == MODE_MMAP && threads > 1) {
+		fprintf(stderr, "mmap supports one thread only\n");
+		return 1;
+	}
+
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers)
+		return 1;
+
+	start = now_ns();
+	deadline = start + duration * 1000000000LL;
+
+	for (i = 0; i < threads; i++) {
+		workers[i].index = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_main,
+							&workers[i])) {
+			fprintf(stderr, "cannot start thread %d\n", i);
+			threads = i;
+			break;
+		}
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].ret)
+			ret = 1;
+		total.samples += workers[i].samples;
+		total.timeouts += workers[i].timeouts;
+		total.errors += workers[i].errors;
+		series_merge(&total.latency, &workers[i].latency);
+		series_merge(&total.interval, &workers[i].interval);
+	}
+
+	report(&total, (now_ns() - start) / 1e9);
+
+	free(total.latency.v);
+	free(total.interval.v);
+	free(workers);
+
+	return ret;
+}
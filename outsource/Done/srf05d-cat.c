@@ -0,0 +1,72 @@
+/*
+ * srf05d-cat: prints the samples srf05d publishes, an example reader
+ *
+ *   gcc -O2 -Wall -o srf05d-cat srf05d-cat.c -lrt
+ *
+ *   srf05d-cat [-n shm] [-c count]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "srf05d.h"
+
+int main(int argc, char *argv[])
+{
+	struct timespec timeout = { .tv_sec = 1 };
+	struct srf05_record recs[16];
+	struct srf05d_reader r = { NULL, NULL };
+	const char *name = NULL;
+	long count = -1;
+	int opt, n, i;
+
+	while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+		switch (opt) {
+		case 'n':
+			name = optarg;
+			break;
+		case 'c':
+			count = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n shm] [-c count]\n",
+								argv[0]);
+			return 1;
+		}
+	}
+
+	n = srf05d_attach(&r, name);
+	if (n) {
+		fprintf(stderr, "%s: %s\n", name ? name : SRF05D_SHM,
+							strerror(-n));
+		return 1;
+	}
+
+	while (count) {
+		n = srf05d_read(&r, recs, sizeof(recs) / sizeof(recs[0]),
+								&timeout);
+		if (n < 0) {
+			if (n == -EINTR)
+				continue;
+			fprintf(stderr, "read: %s\n", strerror(-n));
+			break;
+		}
+
+		for (i = 0; i < n && count; i++, count--) {
+			if (recs[i].status)
+				printf("%u %lld error %d\n", recs[i].seq,
+					(long long)recs[i].timestamp,
+					recs[i].status);
+			else
+				printf("%u %lld %d mm\n", recs[i].seq,
+					(long long)recs[i].timestamp,
+					recs[i].distance);
+		}
+		fflush(stdout);
+	}
+
+	srf05d_detach(&r);
+
+	return 0;
+}
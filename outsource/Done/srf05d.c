@@ -0,0 +1,226 @@
+/*
+ * srf05d: pings an SRF05 once per period and fans the results out to
+ * any number of local readers through shared memory, see srf05d.h
+ *
+ *   gcc -O2 -Wall -o srf05d srf05d.c -lrt
+ *
+ *   srf05d [-d dev] [-n shm] [-p period_us] [-s stats_s]
+ *
+ * runs in the foreground. Every stats_s seconds and on SIGUSR1 the lag,
+ * received and dropped records of every client go to stdout; slots of
+ * clients which died without detaching are freed then.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "srf05.h"
+#include "srf05d.h"
+
+static volatile sig_atomic_t stop;
+static volatile sig_atomic_t dump;
+
+static void on_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		dump = 1;
+	else
+		stop = 1;
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(int64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000LL,
+		.tv_nsec = ns % 1000000000LL,
+	};
+
+	/* a signal ends the sleep so stop is seen right away */
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void report(struct srf05d_shm *shm, unsigned long overruns,
+							unsigned long errors)
+{
+	uint32_t head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+	struct srf05d_client *c;
+	unsigned int i;
+	int32_t pid;
+
+	printf("head %u overruns %lu errors %lu\n", head, overruns, errors);
+
+	for (i = 0; i < shm->max_clients; i++) {
+		c = &shm->clients[i];
+		pid = __atomic_load_n(&c->pid, __ATOMIC_ACQUIRE);
+		if (!pid)
+			continue;
+
+		if (kill(pid, 0) && errno == ESRCH) {
+			printf("client %d gone\n", pid);
+			__atomic_store_n(&c->pid, 0, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		printf("client %d lag %u received %llu drops %llu\n", pid,
+			head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE),
+			(unsigned long long)c->received,
+			(unsigned long long)c->drops);
+	}
+	fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-n shm] [-p period_us] [-s stats_s]\n"
+		"  -d  char device (default /dev/srf05)\n"
+		"  -n  shared memory object (default " SRF05D_SHM ")\n"
+		"  -p  ping period in us (default 100000)\n"
+		"  -s  report clients every stats_s seconds, 0: on SIGUSR1 only (default 10)\n",
+		prog);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *device = "/dev/srf05", *name = SRF05D_SHM;
+	unsigned long overruns = 0, errors = 0;
+	int64_t period = 100000000, stats = 10000000000LL;
+	int64_t next, next_stats;
+	struct srf05d_shm *shm;
+	struct srf05_record rec;
+	struct sigaction sa;
+	int opt, fd, shm_fd, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:n:p:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		case 'p':
+			period = strtoll(optarg, NULL, 0) * 1000;
+			break;
+		case 's':
+			stats = strtoll(optarg, NULL, 0) * 1000000000LL;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (period <= 0 || stats < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* no SA_RESTART: a signal has to end a wait for the sensor */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", device, strerror(errno));
+		return 1;
+	}
+
+	shm_fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (shm_fd < 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	/* a running daemon's segment must not be wiped; dies with us */
+	if (flock(shm_fd, LOCK_EX | LOCK_NB)) {
+		fprintf(stderr, "%s: %s\n", name, errno == EWOULDBLOCK ?
+				"in use by another srf05d" : strerror(errno));
+		close(shm_fd);
+		close(fd);
+		return 1;
+	}
+	if (ftruncate(shm_fd, sizeof(*shm))) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		ret = 1;
+		goto out_unlink;
+	}
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED,
+							shm_fd, 0);
+	if (shm == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		ret = 1;
+		goto out_unlink;
+	}
+
+	/* readers check the magic, so it goes in last */
+	memset(shm, 0, sizeof(*shm));
+	shm->version = SRF05D_VERSION;
+	shm->size = SRF05D_RING_SIZE;
+	shm->max_clients = SRF05D_MAX_CLIENTS;
+	shm->period_ns = period;
+	shm->daemon_pid = getpid();
+	__atomic_store_n(&shm->magic, SRF05D_MAGIC, __ATOMIC_RELEASE);
+
+	next = now_ns();
+	next_stats = next + stats;
+
+	while (!stop) {
+		sleep_until(next);
+		if (stop)
+			break;
+
+		/* a single ping which returns the whole record */
+		if (ioctl(fd, START_MEASUREMENT) < 0 ||
+				ioctl(fd, GET_RESULT, &rec) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "%s: %s\n", device, strerror(errno));
+			errors++;
+		} else {
+			srf05d_publish(shm, &rec);
+		}
+
+		next += period;
+		if (next < now_ns()) {
+			next = now_ns() + period;
+			overruns++;
+		}
+
+		if (dump || (stats && now_ns() >= next_stats)) {
+			report(shm, overruns, errors);
+			dump = 0;
+			next_stats = now_ns() + stats;
+		}
+	}
+
+	munmap(shm, sizeof(*shm));
+out_unlink:
+	shm_unlink(name);
+	close(shm_fd);
+	close(fd);
+
+	return ret;
+}
@@ -0,0 +1,203 @@
+/*
+ * srf05d: shared memory interface of the SRF05 fan-out daemon
+ *
+ * srf05d owns /dev/srf05, pings it once per period and appends every
+ * result to a ring of struct srf05_record in the POSIX shared memory
+ * object SRF05D_SHM (or the one given with -n). Any number of local
+ * readers attach to it and consume the ring without a syscall per
+ * sample and without extra pings.
+ *
+ * head counts the records ever written and doubles as futex word:
+ * readers which caught up sleep on it with FUTEX_WAIT, the daemon wakes
+ * them after publishing a record, but only if waiters says there are
+ * any. The records are stable as long as head has not moved size or
+ * more past them, like in the ring of the driver (see srf05.h): the
+ * daemon orders the store to head before it writes the next slot, the
+ * reader checks head again after copying a record.
+ *
+ * only one daemon may own a segment: it holds an flock() on it while it
+ * runs.
+ *
+ * every reader claims one of the client slots, its tail is the position
+ * in the ring and it counts the records it got and the ones it lost
+ * because it fell more than size records behind. srf05d reports the lag
+ * and drops of all clients and frees the slots of dead ones.
+ */
+#ifndef SRF05D_H
+#define SRF05D_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "srf05.h"
+
+#define SRF05D_SHM		"/srf05d"
+#define SRF05D_MAGIC		0x35307273	/* "sr05" */
+#define SRF05D_VERSION		1
+#define SRF05D_RING_SIZE	1024
+#define SRF05D_MAX_CLIENTS	32
+
+struct srf05d_client {
+	int32_t			pid;		/* 0: slot free */
+	uint32_t		tail;
+	uint64_t		received;
+	uint64_t		drops;
+};
+
+struct srf05d_shm {
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		size;		/* records in the ring */
+	uint32_t		max_clients;
+	uint64_t		period_ns;
+	int32_t			daemon_pid;
+	uint32_t		head;		/* futex word */
+	uint32_t		waiters;
+	uint32_t		reserved[9];
+
+	struct srf05d_client	clients[SRF05D_MAX_CLIENTS];
+	struct srf05_record	ring[SRF05D_RING_SIZE];
+};
+
+static inline long srf05d_futex(uint32_t *word, int op, uint32_t val,
+				const struct timespec *timeout)
+{
+	return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+/* the daemon side: publish one record and wake the sleeping readers */
+static inline void srf05d_publish(struct srf05d_shm *shm,
+				const struct srf05_record *rec)
+{
+	uint32_t head = shm->head;
+
+	/*
+	 * the previous head store must be visible before the slot of the
+	 * record size back is overwritten, or a reader checking head after
+	 * its copy could take a torn record for a stable one
+	 */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	shm->ring[head & (shm->size - 1)] = *rec;
+	/* pairs with the reader's increment of waiters and load of head */
+	__atomic_store_n(&shm->head, head + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&shm->waiters, __ATOMIC_SEQ_CST))
+		srf05d_futex(&shm->head, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+struct srf05d_reader {
+	struct srf05d_shm	*shm;
+	struct srf05d_client	*client;
+};
+
+/* maps the ring of the daemon and claims a client slot */
+static inline int srf05d_attach(struct srf05d_reader *r, const char *name)
+{
+	struct srf05d_shm *shm;
+	int32_t free_slot;
+	unsigned int i;
+	int fd;
+
+	fd = shm_open(name ? name : SRF05D_SHM, O_RDWR, 0);
+	if (fd < 0)
+		return -errno;
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED,
+								fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return -errno;
+
+	if (shm->magic != SRF05D_MAGIC || shm->version != SRF05D_VERSION) {
+		munmap(shm, sizeof(*shm));
+		return -EPROTO;
+	}
+
+	for (i = 0; i < shm->max_clients; i++) {
+		free_slot = 0;
+		if (__atomic_compare_exchange_n(&shm->clients[i].pid,
+				&free_slot, getpid(), false,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			break;
+	}
+	if (i == shm->max_clients) {
+		munmap(shm, sizeof(*shm));
+		return -EBUSY;
+	}
+
+	r->shm = shm;
+	r->client = &shm->clients[i];
+	r->client->received = 0;
+	r->client->drops = 0;
+	/* only what comes from now on */
+	__atomic_store_n(&r->client->tail,
+		__atomic_load_n(&shm->head, __ATOMIC_ACQUIRE),
+		__ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static inline void srf05d_detach(struct srf05d_reader *r)
+{
+	__atomic_store_n(&r->client->pid, 0, __ATOMIC_RELEASE);
+	munmap(r->shm, sizeof(*r->shm));
+}
+
+/*
+ * copies up to max pending records to out; with none pending sleeps
+ * until there are some, at most timeout (NULL: forever). Returns the
+ * number of records, 0 on timeout or a negative errno
+ */
+static inline int srf05d_read(struct srf05d_reader *r,
+			struct srf05_record *out, unsigned int max,
+			const struct timespec *timeout)
+{
+	struct srf05d_shm *shm = r->shm;
+	struct srf05d_client *c = r->client;
+	uint32_t size = shm->size;
+	uint32_t tail = c->tail;
+	uint32_t head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+	unsigned int n = 0;
+	long ret;
+
+	if (head == tail) {
+		__atomic_add_fetch(&shm->waiters, 1, __ATOMIC_SEQ_CST);
+		ret = 0;
+		if (__atomic_load_n(&shm->head, __ATOMIC_SEQ_CST) == tail)
+			ret = srf05d_futex(&shm->head, FUTEX_WAIT, tail,
+								timeout);
+		__atomic_sub_fetch(&shm->waiters, 1, __ATOMIC_SEQ_CST);
+		if (ret < 0 && errno != EAGAIN)
+			return errno == ETIMEDOUT ? 0 : -errno;
+		head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+	}
+
+	while (tail != head && n < max) {
+		if (head - tail >= size) {
+			c->drops += head - tail - size + 1;
+			tail = head - size + 1;
+		}
+		out[n] = shm->ring[tail & (size - 1)];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+		/* the slot was reused while copying, try the next one */
+		if (head - tail >= size)
+			continue;
+		n++;
+		tail++;
+	}
+
+	c->received += n;
+	__atomic_store_n(&c->tail, tail, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+#endif /* SRF05D_H */
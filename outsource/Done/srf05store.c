@@ -0,0 +1,641 @@
+/*
+ * srf05store: records SRF05 samples into a compact store and queries it,
+ * see srf05store.h for the format
+ *
+ *   gcc -O2 -Wall -o srf05store srf05store.c -lrt
+ *
+ *   srf05store record [-d dev | -n shm] [-S sync_s] base
+ *	appends the samples of the char device (read(), so the engine has
+ *	to run) or of srf05d to the store, syncing every sync_s seconds
+ *	(default 60) and on SIGINT/SIGTERM
+ *
+ *   srf05store export [-f from] [-t to] base
+ *	prints timestamp_ns,distance_mm,status,seq per sample
+ *
+ *   srf05store agg [-f from] [-t to] [-i interval_s] base
+ *	prints count, errors and min/mean/max distance per interval
+ *	(default 3600 s)
+ *
+ * from and to are seconds since the epoch, negative ones count back
+ * from now; without them the whole store is used.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "srf05.h"
+#include "srf05d.h"
+#include "srf05store.h"
+
+#define NSEC_PER_SEC	1000000000LL
+
+struct store {
+	int				dat_fd;
+	int				idx_fd;
+
+	/* writer: the block being filled and the last sample in it */
+	struct srf05store_block		blk;
+	uint32_t			block;
+	struct srf05store_sample	last;
+	bool				dirty;
+
+	/* reader: the mapped index */
+	void				*map;
+	const struct srf05store_index	*index;
+	size_t				entries;
+	size_t				map_len;
+};
+
+typedef void (*sample_fn)(const struct srf05store_sample *s, void *arg);
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int open_files(struct store *st, const char *base, int flags)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s.dat", base);
+	st->dat_fd = open(path, flags, 0644);
+	if (st->dat_fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s.idx", base);
+	st->idx_fd = open(path, flags, 0644);
+	if (st->idx_fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(st->dat_fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* calls fn for every sample of blk, returns the last one in *last */
+static int decode_block(const struct srf05store_block *blk, sample_fn fn,
+			void *arg, struct srf05store_sample *last)
+{
+	const uint8_t *p = blk->data, *end = blk->data + blk->bytes;
+	struct srf05store_sample s;
+	uint64_t d[3];
+	unsigned int i, k, n;
+
+	if (blk->magic != SRF05STORE_BLOCK_MAGIC || !blk->count ||
+					blk->bytes > sizeof(blk->data))
+		return -1;
+
+	s.ts = blk->first_ts;
+	s.value = blk->first_value;
+	s.seq = blk->first_seq;
+	if (fn)
+		fn(&s, arg);
+
+	for (i = 1; i < blk->count; i++) {
+		for (k = 0; k < 3; k++) {
+			n = srf05store_get_varint(p, end, &d[k]);
+			if (!n)
+				return -1;
+			p += n;
+		}
+		s.ts += srf05store_unzigzag(d[0]);
+		s.value += srf05store_unzigzag(d[1]);
+		s.seq += srf05store_unzigzag(d[2]) + 1;
+		if (fn)
+			fn(&s, arg);
+	}
+
+	if (last)
+		*last = s;
+
+	return 0;
+}
+
+/* writes the block being filled and its index entry in place */
+static int flush_block(struct store *st)
+{
+	struct srf05store_index e = {
+		.first_ts = st->blk.first_ts,
+		.last_ts = st->blk.last_ts,
+		.block = st->block,
+		.count = st->blk.count,
+	};
+
+	if (!st->dirty)
+		return 0;
+
+	if (pwrite(st->dat_fd, &st->blk, sizeof(st->blk),
+			(off_t)st->block * SRF05STORE_BLOCK_SIZE) !=
+							sizeof(st->blk) ||
+	    pwrite(st->idx_fd, &e, sizeof(e),
+			sizeof(struct srf05store_index_header) +
+			(off_t)st->block * sizeof(e)) != sizeof(e)) {
+		fprintf(stderr, "write: %s\n", strerror(errno));
+		return -1;
+	}
+	st->dirty = false;
+
+	return 0;
+}
+
+/* the only place where the store waits for the card */
+static int sync_store(struct store *st)
+{
+	if (flush_block(st))
+		return -1;
+	if (fdatasync(st->dat_fd) || fdatasync(st->idx_fd)) {
+		fprintf(stderr, "sync: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int open_writer(struct store *st, const char *base)
+{
+	struct srf05store_index_header hdr = {
+		.magic = SRF05STORE_INDEX_MAGIC,
+		.version = SRF05STORE_VERSION,
+		.block_size = SRF05STORE_BLOCK_SIZE,
+	};
+	struct srf05store_block blk;
+	struct stat sb;
+	size_t entries;
+	uint32_t b;
+
+	memset(st, 0, sizeof(*st));
+	if (open_files(st, base, O_RDWR | O_CREAT))
+		return -1;
+
+	if (fstat(st->idx_fd, &sb))
+		goto err;
+
+	if (!sb.st_size) {
+		if (pwrite(st->idx_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			goto err;
+		return 0;
+	}
+
+	if (pread(st->idx_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+			hdr.magic != SRF05STORE_INDEX_MAGIC ||
+			hdr.version != SRF05STORE_VERSION ||
+			hdr.block_size != SRF05STORE_BLOCK_SIZE) {
+		fprintf(stderr, "%s.idx: not a store index\n", base);
+		goto err;
+	}
+
+	/* go on filling the last block */
+	entries = (sb.st_size - sizeof(hdr)) /
+					sizeof(struct srf05store_index);
+	if (!entries)
+		return 0;
+
+	st->block = entries - 1;
+	if (pread(st->dat_fd, &st->blk, sizeof(st->blk),
+			(off_t)st->block * SRF05STORE_BLOCK_SIZE) !=
+							sizeof(st->blk) ||
+			decode_block(&st->blk, NULL, NULL, &st->last)) {
+		fprintf(stderr, "%s.dat: block %u damaged, starting a new one\n",
+							base, st->block);
+		st->block++;
+		memset(&st->blk, 0, sizeof(st->blk));
+
+		/* time must not go back, continue from the last good block */
+		for (b = st->block - 1; b-- > 0;) {
+			if (pread(st->dat_fd, &blk, sizeof(blk),
+					(off_t)b * SRF05STORE_BLOCK_SIZE) ==
+							sizeof(blk) &&
+					!decode_block(&blk, NULL, NULL, &st->last))
+				break;
+		}
+	}
+
+	return 0;
+
+err:
+	close(st->dat_fd);
+	close(st->idx_fd);
+	return -1;
+}
+
+static int append(struct store *st, struct srf05store_sample *s)
+{
+	uint8_t buf[30];
+	unsigned int n = 0;
+
+	/*
+	 * the index needs the time to only grow, e.g. across clock steps;
+	 * last is zero for a new store
+	 */
+	if (s->ts < st->last.ts)
+		s->ts = st->last.ts;
+
+	if (st->blk.count) {
+		n += srf05store_put_varint(buf + n,
+				srf05store_zigzag(s->ts - st->last.ts));
+		n += srf05store_put_varint(buf + n,
+				srf05store_zigzag((int64_t)s->value -
+							st->last.value));
+		n += srf05store_put_varint(buf + n,
+				srf05store_zigzag((int32_t)(s->seq -
+							st->last.seq - 1)));
+
+		if (st->blk.bytes + n > sizeof(st->blk.data) ||
+						st->blk.count == UINT16_MAX) {
+			/* full blocks are written once and never again */
+			if (flush_block(st))
+				return -1;
+			st->block++;
+			memset(&st->blk, 0, sizeof(st->blk));
+		}
+	}
+
+	if (!st->blk.count) {
+		st->blk.magic = SRF05STORE_BLOCK_MAGIC;
+		st->blk.first_ts = s->ts;
+		st->blk.first_value = s->value;
+		st->blk.first_seq = s->seq;
+	} else {
+		memcpy(st->blk.data + st->blk.bytes, buf, n);
+		st->blk.bytes += n;
+	}
+	st->blk.count++;
+	st->blk.last_ts = s->ts;
+	st->last = *s;
+	st->dirty = true;
+
+	return 0;
+}
+
+/* fills up to max records from the device or srf05d, 0 on timeout */
+static int fetch(int fd, struct srf05d_reader *r, struct srf05_record *recs,
+							unsigned int max)
+{
+	struct timespec timeout = { .tv_sec = 1 };
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	ssize_t n;
+
+	if (r->shm)
+		return srf05d_read(r, recs, max, &timeout);
+
+	n = poll(&pfd, 1, 1000);
+	if (n <= 0)
+		return n < 0 ? -errno : 0;
+
+	n = read(fd, recs, max * sizeof(*recs));
+	if (n < 0)
+		return errno == EAGAIN ? 0 : -errno;
+
+	return n / sizeof(*recs);
+}
+
+static int cmd_record(int argc, char *argv[])
+{
+	struct srf05d_reader r = { NULL, NULL };
+	const char *device = NULL, *shm = NULL;
+	struct srf05store_sample s;
+	struct srf05_record recs[64];
+	int64_t sync_ns = 60 * NSEC_PER_SEC, next_sync;
+	struct sigaction sa;
+	struct store st;
+	int opt, fd = -1, n, i, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:n:S:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			shm = optarg;
+			break;
+		case 'S':
+			sync_ns = strtoll(optarg, NULL, 0) * NSEC_PER_SEC;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind != argc - 1 || (device && shm))
+		return 2;
+
+	if (shm || !device) {
+		n = srf05d_attach(&r, shm);
+		if (n) {
+			fprintf(stderr, "%s: %s\n", shm ? shm : SRF05D_SHM,
+							strerror(-n));
+			return 1;
+		}
+	} else {
+		fd = open(device, O_RDONLY | O_NONBLOCK);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", device, strerror(errno));
+			return 1;
+		}
+	}
+
+	if (open_writer(&st, argv[optind]))
+		return 1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	next_sync = clock_ns(CLOCK_MONOTONIC) + sync_ns;
+
+	while (!stop) {
+		n = fetch(fd, &r, recs, sizeof(recs) / sizeof(recs[0]));
+		if (n < 0 && n != -EINTR) {
+			fprintf(stderr, "read: %s\n", strerror(-n));
+			ret = 1;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			/* the driver stamps CLOCK_MONOTONIC */
+			s.ts = recs[i].timestamp + clock_ns(CLOCK_REALTIME) -
+						clock_ns(CLOCK_MONOTONIC);
+			s.value = recs[i].status ? recs[i].status :
+							recs[i].distance;
+			s.seq = recs[i].seq;
+			if (append(&st, &s)) {
+				stop = 1;
+				ret = 1;
+				break;
+			}
+		}
+
+		if (clock_ns(CLOCK_MONOTONIC) >= next_sync) {
+			if (sync_store(&st))
+				ret = 1;
+			next_sync += sync_ns;
+		}
+	}
+
+	if (sync_store(&st))
+		ret = 1;
+
+	if (r.shm)
+		srf05d_detach(&r);
+	if (fd >= 0)
+		close(fd);
+	close(st.dat_fd);
+	close(st.idx_fd);
+
+	return ret;
+}
+
+static int open_reader(struct store *st, const char *base)
+{
+	const struct srf05store_index_header *hdr;
+	struct stat sb;
+	void *map;
+
+	memset(st, 0, sizeof(*st));
+	if (open_files(st, base, O_RDONLY))
+		return -1;
+
+	if (fstat(st->idx_fd, &sb) ||
+			sb.st_size < (off_t)sizeof(*hdr)) {
+		fprintf(stderr, "%s.idx: not a store index\n", base);
+		goto err;
+	}
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, st->idx_fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s.idx: %s\n", base, strerror(errno));
+		goto err;
+	}
+
+	hdr = map;
+	if (hdr->magic != SRF05STORE_INDEX_MAGIC ||
+			hdr->version != SRF05STORE_VERSION ||
+			hdr->block_size != SRF05STORE_BLOCK_SIZE) {
+		fprintf(stderr, "%s.idx: not a store index\n", base);
+		munmap(map, sb.st_size);
+		goto err;
+	}
+
+	st->map = map;
+	st->map_len = sb.st_size;
+	st->index = (const void *)(hdr + 1);
+	st->entries = (sb.st_size - sizeof(*hdr)) / sizeof(*st->index);
+
+	return 0;
+
+err:
+	close(st->dat_fd);
+	close(st->idx_fd);
+	return -1;
+}
+
+struct range {
+	int64_t		from;
+	int64_t		to;
+	sample_fn	fn;
+	void		*arg;
+};
+
+static void range_filter(const struct srf05store_sample *s, void *arg)
+{
+	struct range *rg = arg;
+
+	if (s->ts >= rg->from && s->ts <= rg->to)
+		rg->fn(s, rg->arg);
+}
+
+/* binary search for the first block, then read on sequentially */
+static int query(struct store *st, int64_t from, int64_t to, sample_fn fn,
+								void *arg)
+{
+	struct range rg = { from, to, fn, arg };
+	struct srf05store_block blk;
+	size_t lo = 0, hi = st->entries, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (st->index[mid].last_ts < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < st->entries && st->index[lo].first_ts <= to; lo++) {
+		if (pread(st->dat_fd, &blk, sizeof(blk),
+				(off_t)st->index[lo].block *
+				SRF05STORE_BLOCK_SIZE) != sizeof(blk) ||
+				decode_block(&blk, range_filter, &rg, NULL)) {
+			fprintf(stderr, "block %u damaged, skipped\n",
+							st->index[lo].block);
+			continue;
+		}
+	}
+
+	return 0;
+}
+
+/* seconds since the epoch, negative ones relative to now */
+static int64_t parse_time(const char *arg)
+{
+	int64_t t = strtoll(arg, NULL, 0) * NSEC_PER_SEC;
+
+	return t < 0 ? clock_ns(CLOCK_REALTIME) + t : t;
+}
+
+static void export_sample(const struct srf05store_sample *s, void *arg)
+{
+	(void)arg;
+	printf("%lld,%d,%d,%u\n", (long long)s->ts,
+		s->value < 0 ? 0 : s->value, s->value < 0 ? s->value : 0,
+		s->seq);
+}
+
+struct bucket {
+	int64_t		interval;
+	int64_t		start;
+	long		count;
+	long		errors;
+	long		ok;
+	int		min;
+	int		max;
+	double		sum;
+};
+
+static void bucket_print(struct bucket *b)
+{
+	if (!b->count)
+		return;
+
+	printf("%lld,%ld,%ld,%d,%.1f,%d\n", (long long)(b->start / NSEC_PER_SEC),
+		b->count, b->errors, b->ok ? b->min : 0,
+		b->ok ? b->sum / b->ok : 0.0, b->ok ? b->max : 0);
+}
+
+static void agg_sample(const struct srf05store_sample *s, void *arg)
+{
+	struct bucket *b = arg;
+	int64_t start = s->ts - s->ts % b->interval;
+
+	if (start != b->start) {
+		bucket_print(b);
+		b->start = start;
+		b->count = 0;
+		b->errors = 0;
+		b->ok = 0;
+		b->sum = 0;
+	}
+
+	b->count++;
+	if (s->value < 0) {
+		b->errors++;
+		return;
+	}
+	if (!b->ok || s->value < b->min)
+		b->min = s->value;
+	if (!b->ok || s->value > b->max)
+		b->max = s->value;
+	b->ok++;
+	b->sum += s->value;
+}
+
+static int cmd_query(int argc, char *argv[], bool agg)
+{
+	int64_t from = INT64_MIN, to = INT64_MAX;
+	struct bucket b = { .interval = 3600 * NSEC_PER_SEC };
+	struct store st;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:t:i:")) != -1) {
+		switch (opt) {
+		case 'f':
+			from = parse_time(optarg);
+			break;
+		case 't':
+			to = parse_time(optarg);
+			break;
+		case 'i':
+			b.interval = strtoll(optarg, NULL, 0) * NSEC_PER_SEC;
+			break;
+		default:
+			return 2;
+		}
+	}
+	if (optind != argc - 1 || b.interval <= 0)
+		return 2;
+
+	if (open_reader(&st, argv[optind]))
+		return 1;
+
+	if (agg) {
+		printf("start_s,count,errors,min_mm,mean_mm,max_mm\n");
+		query(&st, from, to, agg_sample, &b);
+		bucket_print(&b);
+	} else {
+		printf("timestamp_ns,distance_mm,status,seq\n");
+		query(&st, from, to, export_sample, NULL);
+	}
+
+	munmap(st.map, st.map_len);
+	close(st.dat_fd);
+	close(st.idx_fd);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s record [-d dev | -n shm] [-S sync_s] base\n"
+		"       %s export [-f from] [-t to] base\n"
+		"       %s agg [-f from] [-t to] [-i interval_s] base\n",
+		prog, prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = 2;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	/* the options of the command follow it */
+	if (!strcmp(argv[1], "record"))
+		ret = cmd_record(argc - 1, argv + 1);
+	else if (!strcmp(argv[1], "export"))
+		ret = cmd_query(argc - 1, argv + 1, false);
+	else if (!strcmp(argv[1], "agg"))
+		ret = cmd_query(argc - 1, argv + 1, true);
+
+	if (ret == 2)
+		usage(argv[0]);
+
+	return ret;
+}
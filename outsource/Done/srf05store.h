@@ -0,0 +1,109 @@
+/*
+ * srf05store: on-disk format of the SRF05 sample store
+ *
+ * a store <base> consists of two append-only files:
+ *
+ * <base>.dat holds SRF05STORE_BLOCK_SIZE sized blocks of samples. The
+ * first sample of a block is in its header, every further one is three
+ * varints of zigzag encoded deltas to the one before: timestamp (ns),
+ * value (distance in mm or the negative errno of a failed cycle) and
+ * sequence number minus one. A sample at 10 Hz typically takes 5 to 7
+ * bytes instead of the 24 of struct srf05_record, so one block holds
+ * well over ten minutes of it.
+ *
+ * <base>.idx holds a header and one struct srf05store_index per block,
+ * entry n describing block n. Timestamps only grow, so the entries are
+ * sorted by time and a time range is found by binary search on the
+ * mmap()ed index plus a sequential read of the blocks it spans.
+ *
+ * the writer only writes whole blocks at block offsets. The block being
+ * filled is written in place, together with its index entry, each time
+ * the data is synced, so an SD card sees one rewrite of the same block
+ * per sync interval rather than one write per sample.
+ *
+ * timestamps are CLOCK_REALTIME ns so the history survives reboots.
+ */
+#ifndef SRF05STORE_H
+#define SRF05STORE_H
+
+#include <stdint.h>
+
+#define SRF05STORE_BLOCK_MAGIC	0x6b6c6273	/* "sblk" */
+#define SRF05STORE_INDEX_MAGIC	0x78646973	/* "sidx" */
+#define SRF05STORE_VERSION	1
+#define SRF05STORE_BLOCK_SIZE	4096
+
+struct srf05store_block {
+	uint32_t	magic;
+	uint16_t	count;		/* samples, including the first one */
+	uint16_t	bytes;		/* of data in use */
+	int64_t		first_ts;
+	int64_t		last_ts;
+	int32_t		first_value;
+	uint32_t	first_seq;
+	uint8_t		data[SRF05STORE_BLOCK_SIZE - 32];
+};
+
+struct srf05store_index_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	block_size;
+	uint32_t	reserved[5];
+};
+
+struct srf05store_index {
+	int64_t		first_ts;
+	int64_t		last_ts;
+	uint32_t	block;
+	uint32_t	count;
+};
+
+/* a decoded sample; value is the distance in mm or a negative errno */
+struct srf05store_sample {
+	int64_t		ts;
+	int32_t		value;
+	uint32_t	seq;
+};
+
+static inline uint64_t srf05store_zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t srf05store_unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* returns the bytes written to p, at most 10 */
+static inline unsigned int srf05store_put_varint(uint8_t *p, uint64_t v)
+{
+	unsigned int n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+
+	return n;
+}
+
+/* returns the bytes read from p, 0 if the varint runs past end */
+static inline unsigned int srf05store_get_varint(const uint8_t *p,
+				const uint8_t *end, uint64_t *v)
+{
+	unsigned int n = 0, shift = 0;
+
+	*v = 0;
+	while (p + n < end && shift < 64) {
+		*v |= (uint64_t)(p[n] & 0x7f) << shift;
+		if (!(p[n++] & 0x80))
+			return n;
+		shift += 7;
+	}
+
+	return 0;
+}
+
+#endif /* SRF05STORE_H */